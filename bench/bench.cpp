@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ecsoplatm.h"
+
+// benchmarks of the hot paths (apply joins, update and the pool)
+// every combination of the parameters is run as a scenario, like
+//   bench --entities 1000,100000 --joins 1,2,3 --threads 1,4 --format json
+// and the results are written to stdout, as csv (default) or json
+
+struct Options {
+  std::vector<uint32_t> entities {1000, 100000};
+  std::vector<double> overlap {1.0, 0.5}; // fraction of entities with b and c
+  std::vector<int> joins {1, 2, 3};
+  std::vector<int> exclude {0, 1}; // also exclude entities with d
+  std::vector<double> churn {0.0, 0.01}; // fraction destroyed and created
+  std::vector<int> kernel {1}; // work per entity
+  // don't wait for the applies before update, so frames overlap
+  std::vector<int> pipeline {0, 1};
+  // (hardware_concurrency may not know, and say 0)
+  std::vector<int> threads {
+      static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))};
+  int frames {50};
+  int warmup {5};
+  std::string format {"csv"};
+};
+
+struct Result {
+  double seconds; // in total, for all frames
+  double entities_per_second; // (that the join matched)
+  double p50, p90, p99, max; // frame time, in microseconds
+  double schedule; // fraction of the frame spent in apply (pushing tasks)
+  double update; // fraction of the frame spent in update
+};
+
+// the kernels are function pointers, so the cost is global
+int kernel_cost = 1;
+
+inline void work(float &x) {
+  for (int i = 0; i < kernel_cost; ++i) {
+    x = x*0.999f + 0.001f;
+  }
+}
+
+void kernel_a(float &a) { work(a); }
+void kernel_ab(float &a, float &b) { work(a); b += a; }
+void kernel_abc(float &a, float &b, float &c) { work(a); b += a; c += b; }
+
+template <typename T>
+std::vector<T> parse_list(const std::string &text) {
+  std::vector<T> result;
+  std::stringstream in(text);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    std::stringstream parse(item);
+    T value;
+    parse >> value;
+    result.push_back(value);
+  }
+  return result;
+}
+
+bool parse(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string flag = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    std::string value = argv[++i];
+    if (flag == "--entities") options.entities = parse_list<uint32_t>(value);
+    else if (flag == "--overlap") options.overlap = parse_list<double>(value);
+    else if (flag == "--joins") options.joins = parse_list<int>(value);
+    else if (flag == "--exclude") options.exclude = parse_list<int>(value);
+    else if (flag == "--churn") options.churn = parse_list<double>(value);
+    else if (flag == "--kernel") options.kernel = parse_list<int>(value);
+    else if (flag == "--pipeline") options.pipeline = parse_list<int>(value);
+    else if (flag == "--threads") options.threads = parse_list<int>(value);
+    else if (flag == "--frames") options.frames = std::atoi(value.c_str());
+    else if (flag == "--warmup") options.warmup = std::atoi(value.c_str());
+    else if (flag == "--format") options.format = value;
+    else return false;
+  }
+  return true;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  size_t i = std::min(sorted.size() - 1,
+                      static_cast<size_t>(p*(sorted.size() - 1) + 0.5));
+  return sorted[i];
+}
+
+size_t count_matched(ecs::Component<float> &a, ecs::Component<float> &b,
+                     ecs::Component<float> &c, ecs::Component<float> &d,
+                     int joins, int exclude) {
+  // how many entities the apply of a scenario calls the kernel for
+  size_t count = 0;
+  for (auto &[id, value]: a.data) {
+    if ((joins >= 2) && !b.exists(id)) continue;
+    if ((joins == 3) && !c.exists(id)) continue;
+    if (exclude && d.exists(id)) continue;
+    ++count;
+  }
+  return count;
+}
+
+Result run(uint32_t n, double overlap, int joins, int exclude, double churn,
+           int pipeline, int threads, const Options &options) {
+  using clock = std::chrono::steady_clock;
+  auto micros = [](clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+
+  ecs::Manager ecs(threads);
+  ecs::Component<float> a, b, c, d;
+  ecs.enlist(&a, "a");
+  ecs.enlist(&b, "b");
+  ecs.enlist(&c, "c");
+  ecs.enlist(&d, "d");
+
+  std::mt19937 rng(1337);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  auto populate = [&](uint32_t id) {
+    a.create(id, 1.0f);
+    if (uniform(rng) < overlap) b.create(id, 1.0f);
+    if (uniform(rng) < overlap) c.create(id, 1.0f);
+    if (uniform(rng) < 0.1) d.create(id, 1.0f);
+  };
+  std::vector<uint32_t> alive;
+  auto ids = ecs.get_ids(n);
+  for (auto id = ids.first; id < ids.last; ++id) {
+    populate(id);
+    alive.push_back(id);
+  }
+  ecs.update();
+
+  std::vector<double> frames;
+  double schedule = 0.0, update = 0.0, total = 0.0;
+  size_t visited = 0;
+  for (int frame = 0; frame < options.warmup + options.frames; ++frame) {
+    // the entities this frame's apply visits (before anything is timed)
+    size_t matched = count_matched(a, b, c, d, joins, exclude);
+    auto start = clock::now();
+
+    // churn, i.e. destroy some random entities and create as many
+    // (distinct ones, shuffled to the front, so no id is destroyed twice)
+    size_t n_churn = churn*alive.size();
+    for (size_t k = 0; k < n_churn; ++k) {
+      std::swap(alive[k], alive[k + rng() % (alive.size() - k)]);
+      ecs.destroy(alive[k]);
+    }
+    for (size_t k = 0; k < n_churn; ++k) {
+      alive[k] = ecs.get_id();
+      populate(alive[k]);
+    }
+
+    auto scheduled = clock::now();
+    if (joins == 1) {
+      if (exclude) ecs.apply(a, kernel_a, d);
+      else ecs.apply(a, kernel_a);
+    } else if (joins == 2) {
+      if (exclude) ecs.apply(a, b, kernel_ab, d);
+      else ecs.apply(a, b, kernel_ab);
+    } else {
+      if (exclude) ecs.apply(a, b, c, kernel_abc, d);
+      else ecs.apply(a, b, c, kernel_abc);
+    }
+    auto applied = clock::now();
+    // (pipelined, update only waits for the tasks that use each component)
+    if (!pipeline) ecs.wait();
+    auto waited = clock::now();
+    ecs.update();
+    auto end = clock::now();
+
+    if (frame < options.warmup)
+      continue;
+    frames.push_back(micros(end - start));
+    schedule += micros(applied - scheduled);
+    update += micros(end - waited);
+    total += micros(end - start);
+    visited += matched;
+  }
+
+  // pipelined, the last frames may still be running
+  auto start = clock::now();
+  ecs.wait();
+  total += micros(clock::now() - start);
+
+  std::sort(frames.begin(), frames.end());
+  Result result;
+  result.seconds = total*1e-6;
+  result.entities_per_second = visited/std::max(result.seconds, 1e-9);
+  result.p50 = percentile(frames, 0.5);
+  result.p90 = percentile(frames, 0.9);
+  result.p99 = percentile(frames, 0.99);
+  result.max = frames.empty() ? 0.0 : frames.back();
+  result.schedule = schedule/std::max(total, 1e-9);
+  result.update = update/std::max(total, 1e-9);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse(argc, argv, options) ||
+      ((options.format != "csv") && (options.format != "json"))) {
+    std::cerr << "usage: " << argv[0] << " [--entities n,...]"
+              << " [--overlap r,...] [--joins 1,2,3] [--exclude 0,1]"
+              << " [--churn r,...] [--kernel n,...] [--pipeline 0,1]"
+              << " [--threads n,...]"
+              << " [--frames n] [--warmup n] [--format csv|json]"
+              << std::endl;
+    return 1;
+  }
+
+  bool json = options.format == "json";
+  if (json) {
+    std::cout << '[' << std::endl;
+  } else {
+    std::cout << "entities,overlap,joins,exclude,churn,kernel,pipeline,"
+              << "threads,frames,"
+              << "seconds,entities_per_second,p50_us,p90_us,p99_us,max_us,"
+              << "schedule_fraction,update_fraction" << std::endl;
+  }
+  bool first = true;
+  for (auto n: options.entities)
+  for (auto overlap: options.overlap)
+  for (auto joins: options.joins)
+  for (auto exclude: options.exclude)
+  for (auto churn: options.churn)
+  for (auto kernel: options.kernel)
+  for (auto pipeline: options.pipeline)
+  for (auto threads: options.threads) {
+    kernel_cost = kernel;
+    auto r = run(n, overlap, joins, exclude, churn, pipeline, threads, options);
+    if (json) {
+      std::cout << (first ? "" : ",\n")
+                << "  {\"entities\": " << n << ", \"overlap\": " << overlap
+                << ", \"joins\": " << joins << ", \"exclude\": " << exclude
+                << ", \"churn\": " << churn << ", \"kernel\": " << kernel
+                << ", \"pipeline\": " << pipeline
+                << ", \"threads\": " << threads
+                << ", \"frames\": " << options.frames
+                << ", \"seconds\": " << r.seconds
+                << ", \"entities_per_second\": " << r.entities_per_second
+                << ", \"p50_us\": " << r.p50 << ", \"p90_us\": " << r.p90
+                << ", \"p99_us\": " << r.p99 << ", \"max_us\": " << r.max
+                << ", \"schedule_fraction\": " << r.schedule
+                << ", \"update_fraction\": " << r.update << '}';
+    } else {
+      std::cout << n << ',' << overlap << ',' << joins << ',' << exclude << ','
+                << churn << ',' << kernel << ',' << pipeline << ','
+                << threads << ','
+                << options.frames << ',' << r.seconds << ','
+                << r.entities_per_second << ',' << r.p50 << ',' << r.p90 << ','
+                << r.p99 << ',' << r.max << ',' << r.schedule << ','
+                << r.update << std::endl;
+    }
+    first = false;
+  }
+  if (json) {
+    std::cout << std::endl << ']' << std::endl;
+  }
+}
@@ -3,17 +3,42 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <new>
+#include <span>
+#include <source_location>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <tuple>
 #include <type_traits>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ECSOPLATM_MMAP
+#endif
+
 
 // VERSION 2.1.0
 
@@ -52,10 +77,27 @@ namespace ecs {
   // 2 ^ CACHE_BITS is the size of the caches in each component
   // since the cache is invalidated when calling update
   // it doesn't make sense to have a huge cache
+  // CACHE_LINE is used to pad per-task data so that tasks don't false share
+  // MAX_COMPONENTS is the number of components that the manager keeps track of
+  // per entity (any components enlisted beyond that work, but more slowly)
 
   const int BLOCK_SIZE = 256;
   const int CACHE_BITS = 4;
   const int CACHE_SIZE = 0x1 << CACHE_BITS;
+  const int CACHE_LINE = 64;
+  const int MAX_COMPONENTS = 64;
+
+  using Signature = std::bitset<MAX_COMPONENTS>; // what components an entity has
+
+  // the elements that the running task has stepped through, see Manager::stats
+  inline thread_local uint64_t visits {0};
+
+
+  template <typename R>
+  struct alignas(CACHE_LINE) Partial {
+    // a partial result of a reduction, padded to a full cache line
+    R value;
+  };
 
 
   template <typename T>
@@ -67,62 +109,153 @@ namespace ecs {
      * And then store another T in like [2, 4] = t2
      * Which creates [2, 4] = t2, [5] = t1
      * And obviously we can do lookups with an interavl as well
+     * The intervals are kept in a map from first to (last, value)
+     * so both set and get are logarithmic (plus the number of intervals
+     * that are overwritten or found)
+     * If read_only, the data is never written while the values are running
+     * so get has nothing to wait for, and the values are only kept for values
+     * If reading (see Manager::run_systems), set records a reader instead,
+     * which get only returns when not reading, so readers don't wait
+     * for each other, but a writer waits for all of them
      */
 
     void set(int first, int last, T value) {
-      // first put our key into the vector
-      auto it = std::lower_bound(
-          data.begin(), data.end(), first,
-          [](const std::tuple<int, int, T> &a, const int &b) {
-            return std::get<0>(a) < b;
-          });
-      it = data.insert(it, std::make_tuple(first, last, value));
-      // then, determine if we need to shorten the previous interval
-      auto prev = it;
-      while (prev != data.begin()) {
-        --prev;
-        if (std::get<1>(*prev) > first) {
-          if (std::get<1>(*prev) > last) {
+      touched = true;
+      if (first >= last)
+        return; // an empty interval doesn't cover anything
+      if (read_only) {
+        readers.push_back(value);
+        return;
+      }
+      if (reading) {
+        reads.emplace_back(first, last, value);
+        return;
+      }
+      ++writes;
+      // the readers within the interval are waited for by this writer
+      // so later tasks only need to wait for the writer
+      std::erase_if(reads, [first, last](const auto &read) {
+        return (std::get<0>(read) >= first) && (std::get<1>(read) <= last);
+      });
+      // determine if we need to shorten the previous interval
+      auto next = data.lower_bound(first);
+      if (next != data.begin()) {
+        auto prev = std::prev(next);
+        int prev_last = prev->second.first;
+        if (prev_last > first) {
+          prev->second.first = first;
+          if (prev_last > last) {
             // if we're inserting in the middle, we need to create a new entry
-            int tmp = std::get<1>(*prev);
-            std::get<1>(*prev) = first;
-            ++it;
-            data.insert(it, std::make_tuple(last, tmp, std::get<2>(*prev)));
-            return;
-          } else {
-            // otherwise we just shorten the prior
-            std::get<1>(*prev) = first;
+            data.emplace_hint(next, last,
+                              std::make_pair(prev_last, prev->second.second));
           }
-        } else {
-          break;
         }
       }
-      // then, determine the number of following intervals that were overwritten
-      auto next = it;
-      ++next;
-      while (next != data.end()) {
-        if (std::get<1>(*next) <= last) {
-          // we've entirely overwritten this one
-          next = data.erase(next);
-          --next;
-        } else if (std::get<0>(*next) < last) {
-          std::get<0>(*next) = last;
+      // then, remove the following intervals that were overwritten
+      // keeping the end of the last one if it sticks out
+      while ((next != data.end()) && (next->first < last)) {
+        if (next->second.first > last) {
+          data.emplace(last, next->second);
         }
-        ++next;
+        next = data.erase(next);
       }
+      data.emplace_hint(next, first, std::make_pair(last, value));
     }
 
     std::vector<T> get(int first, int last) {
+      touched = true;
       std::vector<T> result;
-      for (auto &[f, l, v]: data) {
-        if (!(last <= f) & !(first >= l)) {
-          result.push_back(v);
+      if (!reading) {
+        for (auto &[read_first, read_last, value]: reads) {
+          if ((read_first < last) && (read_last > first)) {
+            result.push_back(value);
+          }
         }
       }
+      auto it = data.upper_bound(first);
+      if (it != data.begin()) {
+        // the interval that starts before first might still overlap
+        auto prev = std::prev(it);
+        if ((prev->first < last) && (prev->second.first > first)) {
+          result.push_back(prev->second.second);
+        }
+      }
+      while ((it != data.end()) && (it->first < last)) {
+        result.push_back(it->second.second);
+        ++it;
+      }
+      return result;
+    }
+
+    void clear() {
+      data.clear();
+      readers.clear();
+      reads.clear();
+    }
+
+    std::vector<T> values() {
+      std::vector<T> result(readers);
+      result.reserve(data.size() + readers.size() + reads.size());
+      for (auto &[first, interval]: data) {
+        result.push_back(interval.second);
+      }
+      for (auto &[first, last, value]: reads) {
+        result.push_back(value);
+      }
       return result;
     }
 
-    std::vector<std::tuple<int, int, T>> data;
+    size_t bytes() const {
+      // roughly, since a map node also has some pointers and a colour
+      return data.size()*(sizeof(typename decltype(data)::value_type) +
+                          4*sizeof(void *)) +
+             readers.capacity()*sizeof(T) +
+             reads.capacity()*sizeof(typename decltype(reads)::value_type);
+    }
+
+    std::map<int, std::pair<int, T>> data; // first -> (last, value)
+    bool read_only {false};
+    std::vector<T> readers;
+    bool reading {false};
+    std::vector<std::tuple<int, int, T>> reads; // (first, last, value)
+    bool touched {false}; // by get or set, see Manager::run_systems
+    uint64_t writes {0}; // sets that weren't reads (clear keeps the count)
+  };
+
+
+  struct MemoryStats {
+    // how much memory a component (or the pool) uses
+    size_t size {0}; // number of elements (or tasks)
+    size_t capacity {0}; // number of elements (or tasks) there is room for
+    size_t bytes {0}; // all the heap memory, including queues and buffers
+    size_t create_high_water {0}; // most creations (tasks) in one update
+    size_t destroy_high_water {0}; // most destructions in one update
+
+    MemoryStats &operator+=(const MemoryStats &other) {
+      size += other.size;
+      capacity += other.capacity;
+      bytes += other.bytes;
+      create_high_water += other.create_high_water;
+      destroy_high_water += other.destroy_high_water;
+      return *this;
+    }
+  };
+
+
+  struct ShrinkPolicy {
+    // update gives back the memory of a vector that has room for
+    // more than slack times its size, if that's more than min_capacity
+    bool enabled {false};
+    double slack {4.0};
+    size_t min_capacity {1024};
+
+    template <typename V>
+    void apply(V &v) const {
+      if (enabled && (v.capacity() > min_capacity) &&
+          (v.capacity() > slack*v.size())) {
+        v.shrink_to_fit();
+      }
+    }
   };
 
 
@@ -138,6 +271,10 @@ namespace ecs {
     * It implements a waiting system where a pushed task can be required
     * to wait for some prior task to finish before entering the work queue.
     * This enables us to queue tasks that will sequentially modify the same data.
+    * Task ids only ever grow (until the pool is reset, when it's idle),
+    * and the tasks before the first unfinished one are dropped as they finish,
+    * so the lists don't grow when frames are pipelined without waiting.
+    * Any id before base is a dropped task, and so it's done.
     */
 
   public:
@@ -173,10 +310,54 @@ namespace ecs {
         return (n_tasks == 0);
       });
 
-      total_tasks = 0;
-      tasks.clear();
-      flags.clear();
-      conditions.clear();
+      reset();
+    }
+
+    void wait_for(const std::vector<int> &ids) {
+      // wait for only some tasks to finish
+      std::unique_lock<std::mutex> lock(tasks_mutex);
+      tasks_done_condition.wait(lock, [&] {
+        return std::all_of(ids.begin(), ids.end(), [&](int id) {
+          return status(id) == DONE;
+        });
+      });
+    }
+
+    void wait_for_all_before(int id) {
+      // wait for every task that was pushed before id
+      std::unique_lock<std::mutex> lock(tasks_mutex);
+      tasks_done_condition.wait(lock, [&] {
+        return (base >= id) || (n_tasks == 0);
+      });
+    }
+
+    template <typename E>
+    void forget_done(std::vector<E> &ids) {
+      // drop the ids of the tasks that are done, which needn't be waited for
+      // (or the entries that end with such an id, see IntervalMap::reads)
+      std::scoped_lock lock(tasks_mutex);
+      std::erase_if(ids, [&](const E &e) {
+        if constexpr (std::is_same_v<E, int>) {
+          return status(e) == DONE;
+        } else {
+          return status(std::get<std::tuple_size_v<E> - 1>(e)) == DONE;
+        }
+      });
+    }
+
+    int next_id() {
+      // the id that the next task will get
+      std::scoped_lock lock(tasks_mutex);
+      return total_tasks;
+    }
+
+    bool reset_if_idle() {
+      // if all tasks are done, forget them, which invalidates all task ids
+      std::scoped_lock lock(tasks_mutex);
+      if (n_tasks > 0)
+        return false;
+      reset();
+      return true;
     }
 
     template <typename F>
@@ -185,11 +366,13 @@ namespace ecs {
       int id;
       {
         std::scoped_lock lock(tasks_mutex);
+        normalize(conds);
         tasks.push_back(task);
         conditions.push_back(std::move(conds));
         flags.push_back(WAITING);
         ++n_tasks;
         id = total_tasks++;
+        high_water = std::max(high_water, tasks.size());
       }
       task_available_condition.notify_one();
       return id;
@@ -202,13 +385,121 @@ namespace ecs {
       return push_task(task, vconds);
     }
 
+    int size() const { return n_threads; }
+
+    double utilization() {
+      // the fraction of the time that the workers have spent running tasks
+      // since they were started (or since reset_utilization)
+      std::scoped_lock lock(tasks_mutex);
+      double elapsed = std::chrono::nanoseconds(
+          std::chrono::steady_clock::now() - since).count();
+      uint64_t total = 0;
+      for (auto b: busy) {
+        total += b;
+      }
+      return total/std::max(elapsed*n_threads, 1.0);
+    }
+
+    void reset_utilization() {
+      std::scoped_lock lock(tasks_mutex);
+      busy.assign(n_threads, 0);
+      since = std::chrono::steady_clock::now();
+    }
+
+    MemoryStats memory() {
+      std::scoped_lock lock(tasks_mutex);
+      MemoryStats stats;
+      stats.size = tasks.size();
+      stats.capacity = tasks.size(); // (a deque has no spare capacity to speak of)
+      stats.create_high_water = high_water;
+      stats.bytes = tasks.size()*sizeof(std::function<void()>) +
+                    flags.size()*sizeof(char) +
+                    conditions.size()*sizeof(std::vector<int>);
+      for (auto &c: conditions) {
+        stats.bytes += c.capacity()*sizeof(int);
+      }
+      return stats;
+    }
+
+    void shrink(const ShrinkPolicy &policy) {
+      // the task lists can only shrink once they've been reset
+      std::scoped_lock lock(tasks_mutex);
+      if ((total_tasks > 0) || !policy.enabled)
+        return;
+      tasks.shrink_to_fit();
+      flags.shrink_to_fit();
+      conditions.shrink_to_fit();
+    }
+
+    static int current_worker(const Flowpool *pool) {
+      // the index of the calling worker thread, if it belongs to pool
+      // otherwise (e.g. on the main thread) -1
+      return (pool == worker_pool) ? worker_index : -1;
+    }
+
 
   private:
 
+    void reset() {
+      // must be called with tasks_mutex locked, and no unfinished tasks
+      total_tasks = 0;
+      first_waiting = 0;
+      base = 0;
+      tasks.clear();
+      flags.clear();
+      conditions.clear();
+    }
+
+    void normalize(std::vector<int> &conds) {
+      // removes conditions that are duplicates, already done,
+      // or implied by another condition (since it is already waited for)
+      // must be called with tasks_mutex locked
+      std::sort(conds.begin(), conds.end());
+      conds.erase(std::unique(conds.begin(), conds.end()), conds.end());
+      conds.erase(std::remove_if(conds.begin(), conds.end(), [&](int cond) {
+        return status(cond) == DONE;
+      }), conds.end());
+      if (conds.size() < 2)
+        return;
+      std::vector<char> implied(conds.size(), false);
+      for (auto cond: conds) {
+        for (auto prior: conditions[cond - base]) {
+          auto it = std::lower_bound(conds.begin(), conds.end(), prior);
+          if ((it != conds.end()) && (*it == prior)) {
+            implied[it - conds.begin()] = true;
+          }
+        }
+      }
+      size_t j = 0;
+      for (size_t i = 0; i < conds.size(); ++i) {
+        if (!implied[i]) {
+          conds[j++] = conds[i];
+        }
+      }
+      conds.resize(j);
+    }
+
+    TaskStatus status(int id) const {
+      // must be called with tasks_mutex locked
+      return (id < base) ? DONE : static_cast<TaskStatus>(flags[id - base]);
+    }
+
+    void drop_done() {
+      // forget the finished tasks at the front, which keeps their ids done
+      // must be called with tasks_mutex locked
+      while (!flags.empty() && (flags.front() == DONE)) {
+        flags.pop_front();
+        tasks.pop_front();
+        conditions.pop_front();
+        ++base;
+      }
+    }
+
     void create_threads() {
+      busy.assign(n_threads, 0);
       threads = std::make_unique<std::thread[]>(n_threads);
       for (int i = 0; i < n_threads; ++i) {
-        threads[i] = std::thread(&Flowpool::worker, this);
+        threads[i] = std::thread(&Flowpool::worker, this, i);
       }
     }
 
@@ -222,39 +513,52 @@ namespace ecs {
     }
 
 
-    void worker() {
+    void worker(int index) {
+      worker_pool = this;
+      worker_index = index;
+
       while (running) {
 
         std::unique_lock<std::mutex> lock(tasks_mutex);
 
         task_available_condition.wait(lock, [&]{
-          return !tasks.empty() || !running;
+          return (first_waiting < total_tasks) || !running;
         });
 
         if (running) {
           // grab the first task from tasks that is doable
           // a task is doable if conds[task].size == 0
           // or if all flags[conds[task]] == true
-          // possible speedup: don't start from 0
-          int task_id = 0;
+          // everything before first_waiting has already been started
+          int task_id = first_waiting;
           while (task_id < total_tasks) {
-            if (flags[task_id] == WAITING) {
+            if (status(task_id) == WAITING) {
               // it's a waiting task, see if it can run
               bool doable = true;
-              for (auto cond: conditions[task_id]) {
-                // possible speedup: short circuit loop
-                doable = doable && (flags[cond] == DONE);
+              for (auto cond: conditions[task_id - base]) {
+                if (status(cond) != DONE) {
+                  doable = false;
+                  break;
+                }
               }
               if (doable) {
-                auto task = std::move(tasks[task_id]);
-                flags[task_id] = IN_PROGRESS;
+                auto task = std::move(tasks[task_id - base]);
+                flags[task_id - base] = IN_PROGRESS;
+                while ((first_waiting < total_tasks) &&
+                       (status(first_waiting) != WAITING)) {
+                  ++first_waiting;
+                }
 
                 lock.unlock();
+                auto start = std::chrono::steady_clock::now();
                 task();
+                auto end = std::chrono::steady_clock::now();
                 lock.lock();
 
-                flags[task_id] = DONE;
+                busy[index] += std::chrono::nanoseconds(end - start).count();
+                flags[task_id - base] = DONE;
                 --n_tasks;
+                drop_done();
                 break;
               }
             }
@@ -262,7 +566,8 @@ namespace ecs {
           }
 
           lock.unlock();
-          tasks_done_condition.notify_one();
+          // several threads can be waiting for different tasks
+          tasks_done_condition.notify_all();
         }
       }
     }
@@ -272,6 +577,9 @@ namespace ecs {
     int n_threads;
     std::unique_ptr<std::thread[]> threads;
 
+    static inline thread_local const Flowpool *worker_pool {nullptr};
+    static inline thread_local int worker_index {-1};
+
     std::mutex tasks_mutex; // locks tasks, n_tasks, flags, and conditions
 
     std::condition_variable task_available_condition;
@@ -280,20 +588,234 @@ namespace ecs {
     std::atomic<bool> running {true};
     int n_tasks {0}; // total number of waiting, queued, and running tasks
     int total_tasks {0}; // total number of tasks queued since last wait
+    int first_waiting {0}; // all tasks before this one have been started
+    int base {0}; // the id of the first task still in the lists
+    size_t high_water {0}; // the most tasks in the lists at once
+    std::vector<uint64_t> busy; // nanoseconds spent in tasks, per worker
+    std::chrono::steady_clock::time_point since {std::chrono::steady_clock::now()};
+
+    std::deque<char> flags; // these are indexed by id - base
+    std::deque<std::function<void()>> tasks;
+    std::deque<std::vector<int>> conditions; // ids of tasks to wait for
+  };
+
+
+  template <typename Q>
+  struct alignas(CACHE_LINE) CommandBuffer {
+    // per worker thread queue, padded so that workers don't false share
+    // the mutex is only contended if a component is updated
+    // while a system that doesn't use it is still queueing things into it
+    CommandBuffer() = default;
+    CommandBuffer(CommandBuffer &&other) noexcept
+      : queue(std::move(other.queue)) {}
+
+    std::vector<Q> queue;
+    std::mutex mutex;
+  };
+
 
-    std::vector<char> flags;
-    std::vector<std::function<void()>> tasks;
-    std::vector<std::vector<int>> conditions; // indices into flags
+  struct Delta {
+    // what update changed in a component, as raw elements (for the journal)
+    std::vector<char> modified;
+    std::vector<uint32_t> destroyed;
+    std::vector<char> created;
+
+    bool empty() const {
+      return modified.empty() && destroyed.empty() && created.empty();
+    }
+
+    void clear() {
+      modified.clear();
+      destroyed.clear();
+      created.clear();
+    }
   };
 
 
   struct ComponentInterface {
+
+    /*
+     * create and destroy are only queued, and executed in update.
+     * When called from within an apply (i.e. on a worker thread of the pool
+     * the component is enlisted with) they go into a per worker buffer
+     * so that systems can safely create and destroy things.
+     * The buffers are merged into the queues at the start of update
+     */
+
     virtual void update() = 0;
     virtual bool exists(uint32_t) = 0;
-    void destroy(uint32_t id) { destroy_queue.push_back(id); }
 
+    // for snapshots, a component that can be saved exposes its data as bytes
+    // element_size is 0 if it can't be (i.e. it's not trivially copyable)
+    virtual size_t element_size() { return 0; }
+    virtual size_t count() { return 0; }
+    virtual const char *bytes() { return nullptr; }
+    virtual void load(const char *, size_t) {}
+    // sort the data by id, if it isn't (see Component::set_lazy)
+    virtual bool ensure_sorted() { return false; }
+
+    virtual bool pending() {
+      // is there anything for update to do
+      // (with change tracking, update always has to look for changes)
+      if (!destroy_queue.empty() || (journaled && track_changes))
+        return true;
+      for (auto &buffer: destroy_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        if (!buffer.queue.empty())
+          return true;
+      }
+      return false;
+    }
+
+    virtual MemoryStats memory() {
+      MemoryStats stats;
+      stats.destroy_high_water = destroy_high_water;
+      stats.bytes = destroy_queue.capacity()*sizeof(uint32_t) +
+                    waiting_flags.bytes() +
+                    delta.modified.capacity() + delta.created.capacity() +
+                    delta.destroyed.capacity()*sizeof(uint32_t);
+      for (auto &buffer: destroy_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        stats.bytes += sizeof(buffer) + buffer.queue.capacity()*sizeof(uint32_t);
+      }
+      return stats;
+    }
+
+    virtual void shrink(const ShrinkPolicy &policy) {
+      // only when no tasks use the component, i.e. right after update
+      policy.apply(destroy_queue);
+      policy.apply(delta.modified);
+      policy.apply(delta.destroyed);
+      policy.apply(delta.created);
+      for (auto &buffer: destroy_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        policy.apply(buffer.queue);
+      }
+    }
+
+    // the tasks that update has to wait for, and forgetting about them
+    virtual std::vector<int> waiting() { return waiting_flags.values(); }
+    virtual void clear_waiting() { waiting_flags.clear(); }
+
+    virtual void attach(const Flowpool *pool_,
+                        std::vector<Signature> *signatures_, int index_) {
+      pool = pool_;
+      destroy_buffers.resize(pool->size());
+      if (index_ < MAX_COMPONENTS) {
+        signatures = signatures_;
+        index = index_;
+      }
+    }
+
+    void mark(uint32_t id, bool member) {
+      // keep the signature of the entity up to date, if we're tracked
+      if (index < 0)
+        return;
+      if (id >= signatures->size()) {
+        signatures->resize(id + 1);
+      }
+      (*signatures)[id][index] = member;
+    }
+
+    void destroy(uint32_t id) {
+      int worker = Flowpool::current_worker(pool);
+      if (worker >= 0) {
+        std::scoped_lock lock(destroy_buffers[worker].mutex);
+        destroy_buffers[worker].queue.push_back(id);
+      } else {
+        destroy_queue.push_back(id);
+      }
+    }
+
+    const Flowpool *pool {nullptr}; // the pool of the manager we're enlisted in
+    std::vector<Signature> *signatures {nullptr}; // of the manager, per entity
+    int index {-1}; // our bit in the signatures, -1 if not tracked
     std::vector<uint32_t> destroy_queue;
+    std::vector<CommandBuffer<uint32_t>> destroy_buffers;
     IntervalMap<int> waiting_flags;
+    uint64_t generation {0}; // incremented whenever update changes something
+    size_t destroy_high_water {0}; // most destructions in one update
+
+    // if journaled, update records what it changed in delta
+    // and also what systems changed, if track_changes is set
+    // (which costs a copy of data, that is compared in the next update)
+    // set it with Component::set_track_changes, which checks that
+    // the values can be compared (otherwise it does nothing)
+    bool journaled {false};
+    bool track_changes {false};
+    Delta delta;
+
+    virtual void set_journaled(bool on) { journaled = on; }
+  };
+
+
+  struct IdRange {
+    // a contiguous range of entity ids [first, last)
+    uint32_t first;
+    uint32_t last;
+    size_t size() const { return last - first; }
+  };
+
+
+  template <typename T>
+  struct ZoneMap {
+
+    /*
+     * The first and last id of every BLOCK_SIZE elements of a component
+     * (i.e. the smallest and largest, since it's sorted), rebuilt whenever
+     * the layout of the component changes. A join that looks for an id
+     * can then skip every zone that ends before it, by reading only
+     * the summary, and not all the elements in between.
+     * It remembers what data it was built for, and if an iterator doesn't
+     * point into that (e.g. the data was copied), seek just steps.
+     */
+
+    using Element = std::pair<uint32_t, T>;
+
+    void build(const std::vector<Element> &data) {
+      base = data.data();
+      size = data.size();
+      zones.clear();
+      for (size_t i = 0; i < size; i += BLOCK_SIZE) {
+        size_t last = std::min(i + BLOCK_SIZE, size) - 1;
+        zones.emplace_back(data[i].first, data[last].first);
+      }
+    }
+
+    template <typename I>
+    I seek(I it, I last, uint32_t id) const {
+      // the first element in [it, last) with an id of at least id
+      const Element *p = std::to_address(it);
+      if (std::less<const Element *>{}(p, base) ||
+          !std::less<const Element *>{}(p, base + size)) {
+        while ((it != last) && (it->first < id)) {
+          ++it;
+          ++visits;
+        }
+        return it;
+      }
+      size_t at = p - base;
+      size_t zone = at/BLOCK_SIZE;
+      while ((zone < zones.size()) && (zones[zone].second < id)) {
+        ++zone;
+      }
+      size_t skip = std::max(at, zone*BLOCK_SIZE) - at;
+      if (skip >= static_cast<size_t>(last - it))
+        return last;
+      it += skip;
+      // the zone ends at or after id, so this stops within it
+      while ((it != last) && (it->first < id)) {
+        ++it;
+        ++visits;
+      }
+      return it;
+    }
+
+    size_t bytes() const { return zones.capacity()*sizeof(zones[0]); }
+
+    std::vector<std::pair<uint32_t, uint32_t>> zones;
+    const Element *base {nullptr};
+    size_t size {0};
   };
 
 
@@ -307,6 +829,13 @@ namespace ecs {
 
     T *operator[](uint32_t key) {
 
+      if (lazy) {
+        // the index is faster than the cache anyway
+        if ((key < positions.size()) && (positions[key] != NOWHERE))
+          return &data[positions[key]].second;
+        return nullptr;
+      }
+
       int64_t hashed = key * 0xf9b25d65 >> 8; // see arXiv:2001.05304
       hashed = hashed & (CACHE_SIZE - 1);
 
@@ -333,136 +862,2270 @@ namespace ecs {
     }
 
     void create(uint32_t entity, T value) {
-      create_queue.push_back(std::make_pair(entity, value));
+      int worker = Flowpool::current_worker(pool);
+      if (worker >= 0) {
+        std::scoped_lock lock(create_buffers[worker].mutex);
+        create_buffers[worker].queue.push_back(std::make_pair(entity, value));
+      } else {
+        create_queue.push_back(std::make_pair(entity, value));
+      }
     }
 
-    bool exists(uint32_t id) {
-      return nullptr != this->operator[](id);
+    void create_bulk(IdRange ids, std::span<const T> values) {
+      // create ids.first, ids.first + 1, ... with the corresponding values
+      // since the ids are in order, they don't need to be sorted in update
+      // (if the sizes differ, only as many as both have are created)
+      size_t n = std::min<size_t>(ids.size(), values.size());
+      with_create_queue([&](auto &queue) {
+        queue.reserve(queue.size() + n);
+        for (size_t i = 0; i < n; ++i) {
+          queue.emplace_back(ids.first + i, values[i]);
+        }
+      });
     }
 
-    void update() {
-      // update may invalidate the cache, so erase it
-      cache.fill(std::make_pair(0, nullptr));
-      // execute deferred destruction
-      // first, the destroy queue needs to be sorted
-      std::sort(destroy_queue.begin(), destroy_queue.end(), std::greater<>());
-      // also, remove duplicate erases
-      destroy_queue.erase(std::unique(destroy_queue.begin(), destroy_queue.end()),
-                          destroy_queue.end());
-      // then they can be destroyed in reverse order
-      auto last = --data.end();
-      for (auto i: destroy_queue) {
-        // find the position of the element we're erasing
-        // (still guaranteeed to be in reverse order, since the vector is sorted)
-        auto it = std::lower_bound(data.begin(), data.end(), i,
-                                   [](const std::pair<uint32_t, T> &a,
-                                      uint32_t b) { return a.first < b; });
-        // swap to last, then erase (for speed!)
-        std::swap(data[it - data.begin()], (*last));
-        data.erase(last--);
-      }
-      destroy_queue.clear();
-      // execute deferred creation
-      for (auto &ev: create_queue) {
-        // FIXME? it's not great that this fails silently
-        // if the entity already exists
-        data.push_back(std::move(ev));
-      }
-      create_queue.clear();
-      // sort by entity id
-      std::sort(data.begin(), data.end(),
-                [](const std::pair<uint32_t, T> &a,
-                   const std::pair<uint32_t, T> &b) {
-                  return a.first < b.first;
-                });
+    void create_bulk(std::span<const uint32_t> ids, std::span<const T> values) {
+      size_t n = std::min(ids.size(), values.size());
+      with_create_queue([&](auto &queue) {
+        queue.reserve(queue.size() + n);
+        for (size_t i = 0; i < n; ++i) {
+          queue.emplace_back(ids[i], values[i]);
+        }
+      });
     }
 
-    std::vector<std::pair<uint32_t, T>> data;
-    std::vector<std::pair<uint32_t, T>> create_queue;
-    std::array<std::pair<uint32_t, T *>, CACHE_SIZE> cache;
-
-  };
-
+    template <typename F>
+    void with_create_queue(F f) {
+      // run f on the queue that create should use on this thread
+      int worker = Flowpool::current_worker(pool);
+      if (worker >= 0) {
+        std::scoped_lock lock(create_buffers[worker].mutex);
+        f(create_buffers[worker].queue);
+      } else {
+        f(create_queue);
+      }
+    }
 
-  struct Manager {
+    void attach(const Flowpool *pool_,
+                std::vector<Signature> *signatures_, int index_) {
+      ComponentInterface::attach(pool_, signatures_, index_);
+      create_buffers.resize(pool->size());
+      for (auto &[id, value]: data) {
+        mark(id, true);
+      }
+    }
 
-    /*
-     * This class is how to interact with the entity components
-     * and how to build systems that work with them in parallel.
-     * The main functionality are the apply functions
-     * which take a function and applies it to all entities that
-     * have the required components.
-     */
+    bool pending() {
+      if (!create_queue.empty())
+        return true;
+      for (auto &buffer: create_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        if (!buffer.queue.empty())
+          return true;
+      }
+      return ComponentInterface::pending();
+    }
 
-    uint32_t max_unused_id {1}; // 0 is no entity by definition
-    Flowpool pool;
-    std::vector<ComponentInterface *> components;
-    std::vector<std::string> component_names; // used for debug features
-    std::vector<uint32_t> unused_ids;
+    size_t element_size() {
+      if constexpr (std::is_trivially_copyable_v<T>)
+        return sizeof(std::pair<uint32_t, T>);
+      return 0;
+    }
 
-    Manager() {}
-    Manager(int n_threads)
-      : pool(n_threads) {}
+    size_t count() { return data.size(); }
 
-    uint32_t get_id() {
+    const char *bytes() {
+      if constexpr (PADDED) {
+        // a copy with the padding zeroed, so nothing uninitialized is saved
+        constexpr size_t ELEMENT_SIZE = sizeof(std::pair<uint32_t, T>);
+        saved.resize(data.size()*ELEMENT_SIZE);
+        for (size_t i = 0; i < data.size(); ++i) {
+          copy_element(saved.data() + i*ELEMENT_SIZE, data[i]);
+        }
+        return saved.data();
+      } else {
+        return reinterpret_cast<const char *>(data.data());
+      }
+    }
 
-      /*
-       * Get a new entity id
-       */
+    static void copy_element(char *to, const std::pair<uint32_t, T> &e) {
+      // the raw bytes of an element, but with zeros for the padding
+      // between the id and the value
+      auto from = reinterpret_cast<const char *>(&e);
+      auto value = reinterpret_cast<const char *>(&e.second);
+      std::memset(to, 0, sizeof(e));
+      std::memcpy(to, from, sizeof(uint32_t));
+      std::memcpy(to + (value - from), value, sizeof(T));
+    }
 
-      uint32_t id = max_unused_id;
-      if (!unused_ids.empty()) {
-        id = unused_ids.back();
-        unused_ids.pop_back();
+    static bool same_value(const T &a, const T &b) {
+      // did a system change the value (see track_changes)
+      // the bytes are only compared if they are all there is to the value
+      if constexpr (std::has_unique_object_representations_v<T>) {
+        return std::memcmp(static_cast<const void *>(&a),
+                           static_cast<const void *>(&b), sizeof(T)) == 0;
       } else {
-        ++max_unused_id;
+        return a == b;
       }
-      return id;
     }
 
-    void return_id(uint32_t id) { unused_ids.push_back(id); }
+    void set_track_changes(bool on) {
+      static_assert(TRACKABLE, "track_changes needs a value type without "
+                    "padding (std::has_unique_object_representations) "
+                    "or with an operator==");
+      track_changes = on;
+      take_shadow();
+    }
 
-    template <typename T> void enlist(Component<T> *component) {
-      components.push_back(component);
-      component_names.push_back("UNKNOWN");
+    void set_journaled(bool on) {
+      journaled = on;
+      take_shadow();
     }
 
-    template <typename T> void enlist(Component<T> *component, std::string name) {
-      components.push_back(component);
-      component_names.push_back(name);
+    void take_shadow() {
+      // the next update finds what changed by comparing with this copy
+      // so it's taken whenever tracking starts (or data is replaced)
+      if (TRACKABLE && journaled && track_changes) {
+        shadow = data;
+      } else {
+        shadow.clear();
+      }
     }
 
-    void debug_print_entity_components(uint32_t id) {
-      std::cout << id << " : ";
-      // print what components an entity has
-      for (size_t i = 0; i < components.size(); ++i) {
-        if (components[i]->exists(id)) {
-          std::cout << component_names[i] << ' ';
+    void load(const char *bytes, size_t count) {
+      // replace data with count elements (as saved from bytes())
+      if constexpr (std::is_trivially_copyable_v<T>) {
+        for (auto &[id, value]: data) {
+          mark(id, false);
+        }
+        // the elements are copied in straight from bytes, so T needn't have
+        // a default constructor (snapshot entries are aligned in the file)
+        // only if bytes isn't aligned do they go through an aligned buffer
+        using Element = std::pair<uint32_t, T>;
+        struct alignas(Element) Raw { unsigned char bytes[sizeof(Element)]; };
+        std::vector<Raw> buffer;
+        if (reinterpret_cast<uintptr_t>(bytes) % alignof(Element) != 0) {
+          buffer.resize(count);
+          std::memcpy(buffer.data(), bytes, count*sizeof(Element));
+          bytes = reinterpret_cast<const char *>(buffer.data());
+        }
+        auto first = std::launder(reinterpret_cast<const Element *>(bytes));
+        data.assign(first, first + count);
+        for (auto &[id, value]: data) {
+          mark(id, true);
+        }
+        if (lazy) {
+          sorted = std::is_sorted(data.begin(), data.end(), by_id);
+          reindex();
         }
+        zones.build(data);
+        take_shadow();
+        create_queue.clear();
+        destroy_queue.clear();
+        cache.fill(std::make_pair(0, nullptr));
+        ++generation;
       }
-      std::cout << std::endl;
     }
 
-    void update() {
-      for (auto c : components) {
-        c->update();
-      }
+    bool exists(uint32_t id) {
+      return nullptr != this->operator[](id);
     }
 
-    void destroy(uint32_t id) {
-      /*
-       * Note that this also marks the entity id as unused
-       */
-      for (auto c : components) {
-        c->destroy(id);
+    void update() {
+      constexpr size_t ELEMENT_SIZE = sizeof(std::pair<uint32_t, T>);
+      auto record = [](std::vector<char> &to, const std::pair<uint32_t, T> &e) {
+        to.resize(to.size() + ELEMENT_SIZE);
+        copy_element(to.data() + to.size() - ELEMENT_SIZE, e);
+      };
+      journaled = journaled && (element_size() > 0);
+      if (lazy && journaled) {
+        // journals are merged by id, so these are kept sorted after all
+        ensure_sorted();
+      }
+      delta.clear();
+      // find what the systems changed since the last update
+      // (data has the same layout as shadow, since it was copied)
+      if constexpr (TRACKABLE) {
+        if (journaled && track_changes && (shadow.size() == data.size())) {
+          for (size_t i = 0; i < data.size(); ++i) {
+            if ((data[i].first != shadow[i].first) ||
+                !same_value(data[i].second, shadow[i].second)) {
+              record(delta.modified, data[i]);
+            }
+          }
+        }
+      }
+      // update may invalidate the cache, so erase it
+      cache.fill(std::make_pair(0, nullptr));
+      // gather whatever was queued from within systems
+      // (clear keeps the capacity, so the buffers are reused next frame)
+      for (auto &buffer: destroy_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        destroy_queue.insert(destroy_queue.end(),
+                             buffer.queue.begin(), buffer.queue.end());
+        buffer.queue.clear();
+      }
+      for (auto &buffer: create_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        std::move(buffer.queue.begin(), buffer.queue.end(),
+                  std::back_inserter(create_queue));
+        buffer.queue.clear();
+      }
+      // anything cached about the structure of data (e.g. by a Query)
+      // can check the generation to see if it is still valid
+      if (!destroy_queue.empty() || !create_queue.empty()) {
+        ++generation;
+      }
+      create_high_water = std::max(create_high_water, create_queue.size());
+      destroy_high_water = std::max(destroy_high_water, destroy_queue.size());
+      if (lazy && !journaled) {
+        update_lazy();
+        return;
+      }
+      // execute deferred destruction
+      // first, the destroy queue needs to be sorted
+      std::sort(destroy_queue.begin(), destroy_queue.end());
+      // also, remove duplicate erases
+      destroy_queue.erase(std::unique(destroy_queue.begin(), destroy_queue.end()),
+                          destroy_queue.end());
+      // then they can all be removed in one pass, which keeps data sorted
+      // starting from the first one that is destroyed
+      if (!destroy_queue.empty()) {
+        auto out = std::lower_bound(data.begin(), data.end(),
+                                    destroy_queue.front(),
+                                    [](const std::pair<uint32_t, T> &a,
+                                       uint32_t b) { return a.first < b; });
+        auto kill = destroy_queue.begin();
+        for (auto it = out; it != data.end(); ++it) {
+          while ((kill != destroy_queue.end()) && (*kill < it->first)) {
+            ++kill;
+          }
+          if ((kill != destroy_queue.end()) && (*kill == it->first)) {
+            mark(it->first, false);
+            if (journaled) {
+              delta.destroyed.push_back(it->first);
+            }
+            continue;
+          }
+          if (out != it) {
+            *out = std::move(*it);
+          }
+          ++out;
+        }
+        data.erase(out, data.end());
+      }
+      destroy_queue.clear();
+      // execute deferred creation
+      // the created things are sorted by id (unless they already are,
+      // like after create_bulk) and then merged into data in linear time
+      if (!create_queue.empty()) {
+        if (!std::is_sorted(create_queue.begin(), create_queue.end(), by_id)) {
+          std::sort(create_queue.begin(), create_queue.end(), by_id);
+        }
+        for (auto &ev: create_queue) {
+          // FIXME? it's not great that this fails silently
+          // if the entity already exists
+          mark(ev.first, true);
+          if (journaled) {
+            record(delta.created, ev);
+          }
+        }
+        size_t middle = data.size();
+        data.insert(data.end(), std::make_move_iterator(create_queue.begin()),
+                    std::make_move_iterator(create_queue.end()));
+        std::inplace_merge(data.begin(), data.begin() + middle, data.end(),
+                           by_id);
+      }
+      create_queue.clear();
+      take_shadow();
+      if (lazy) {
+        reindex();
+      }
+      zones.build(data);
+    }
+
+    /*
+     * A lazy component keeps data in the order things were created,
+     * and destroys by moving the last element into the hole, which it finds
+     * through positions (an index by id, which also serves operator[]).
+     * So update never sorts, and only ensure_sorted does, which apply
+     * calls the first time the component is joined with others after
+     * a change (or save does). That suits components that are mostly
+     * applied to alone, or looked up by id, and that change a lot.
+     * Sorting has to wait for the tasks that use the component, so
+     * the first join after a change doesn't overlap with earlier systems
+     * (and from an async system, it blocks the worker it runs on).
+     * A journaled component is kept sorted anyway, since journals are
+     * merged by id. Set it between updates, when nothing uses the component.
+     */
+
+    void set_lazy(bool lazy_) {
+      if (lazy_ == lazy)
+        return;
+      if (lazy_) {
+        lazy = true;
+        reindex();
+      } else {
+        ensure_sorted();
+        lazy = false;
+        positions.clear();
+        positions.shrink_to_fit();
+      }
+    }
+
+    bool ensure_sorted() {
+      if (sorted)
+        return false;
+      std::sort(data.begin(), data.end(), by_id);
+      // shadow has the same ids in the same places, so it stays in step
+      if (shadow.size() == data.size()) {
+        std::sort(shadow.begin(), shadow.end(), by_id);
+      }
+      reindex();
+      zones.build(data);
+      cache.fill(std::make_pair(0, nullptr));
+      ++generation;
+      sorted = true;
+      return true;
+    }
+
+    void update_lazy() {
+      for (auto id: destroy_queue) {
+        if ((id >= positions.size()) || (positions[id] == NOWHERE))
+          continue;
+        uint32_t at = positions[id];
+        positions[id] = NOWHERE;
+        mark(id, false);
+        if (at + 1 != data.size()) {
+          data[at] = std::move(data.back());
+          positions[data[at].first] = at;
+          sorted = false;
+        }
+        data.pop_back();
+      }
+      destroy_queue.clear();
+      for (auto &ev: create_queue) {
+        if ((ev.first < positions.size()) && (positions[ev.first] != NOWHERE))
+          continue; // FIXME? also silent, but at least it isn't added twice
+        if (!data.empty() && (data.back().first > ev.first)) {
+          sorted = false;
+        }
+        place(ev.first, data.size());
+        mark(ev.first, true);
+        data.push_back(std::move(ev));
+      }
+      create_queue.clear();
+      zones.build(data);
+    }
+
+    void reindex() {
+      positions.clear();
+      for (size_t i = 0; i < data.size(); ++i) {
+        place(data[i].first, i);
+      }
+    }
+
+    void place(uint32_t id, size_t at) {
+      if (id >= positions.size()) {
+        positions.resize(id + 1, NOWHERE);
+      }
+      positions[id] = at;
+    }
+
+    static bool by_id(const std::pair<uint32_t, T> &a,
+                      const std::pair<uint32_t, T> &b) {
+      return a.first < b.first;
+    }
+
+    std::vector<std::pair<uint32_t, T>> data;
+    std::vector<std::pair<uint32_t, T>> create_queue;
+    std::vector<CommandBuffer<std::pair<uint32_t, T>>> create_buffers;
+    std::array<std::pair<uint32_t, T *>, CACHE_SIZE> cache;
+    std::vector<std::pair<uint32_t, T>> shadow; // data at the last update
+    std::vector<char> saved; // what bytes returned, if PADDED
+    // whether there are bytes between the id and the value
+    static constexpr bool PADDED =
+        sizeof(std::pair<uint32_t, T>) > sizeof(uint32_t) + sizeof(T);
+    // whether systems' changes to the values can be found (see same_value)
+    static constexpr bool TRACKABLE =
+        std::has_unique_object_representations_v<T> ||
+        std::equality_comparable<T>;
+    size_t create_high_water {0}; // most creations in one update
+    bool lazy {false}; // see set_lazy
+    bool sorted {true}; // data is sorted by id (always, unless lazy)
+    std::vector<uint32_t> positions; // of every id in data, if lazy
+    ZoneMap<T> zones; // of data, rebuilt by update
+    static constexpr uint32_t NOWHERE = UINT32_MAX;
+
+    MemoryStats memory() {
+      constexpr size_t ELEMENT_SIZE = sizeof(std::pair<uint32_t, T>);
+      MemoryStats stats = ComponentInterface::memory();
+      stats.size = data.size();
+      stats.capacity = data.capacity();
+      stats.create_high_water = create_high_water;
+      stats.bytes += (data.capacity() + create_queue.capacity() +
+                      shadow.capacity())*ELEMENT_SIZE + saved.capacity() +
+                     positions.capacity()*sizeof(uint32_t) + zones.bytes();
+      for (auto &buffer: create_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        stats.bytes += sizeof(buffer) + buffer.queue.capacity()*ELEMENT_SIZE;
+      }
+      return stats;
+    }
+
+    void shrink(const ShrinkPolicy &policy) {
+      ComponentInterface::shrink(policy);
+      policy.apply(data);
+      zones.build(data); // in case data moved
+      policy.apply(create_queue);
+      policy.apply(shadow);
+      policy.apply(saved);
+      for (auto &buffer: create_buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        policy.apply(buffer.queue);
+      }
+    }
+  };
+
+
+  template <typename T>
+  struct Optional {
+    // marks a component as optional when passed to apply
+    Component<T> &component;
+  };
+
+  template <typename T>
+  Optional<T> optional(Component<T> &component) { return {component}; }
+
+
+  template <typename T>
+  struct ReadOnly {
+    // a component that apply can only read (see DoubleBuffered::front)
+    // so the functions applied to it take a const reference
+    Component<T> &component;
+    const Component<T> *operator->() const { return &component; }
+  };
+
+  template <typename C> struct DoubleBuffered;
+
+  template <typename T>
+  struct DoubleBuffered<Component<T>> : Component<T> {
+
+    /*
+     * A component that also keeps its state as of the last update.
+     * front() is that previous state, and is read only between updates,
+     * back() is the next state, which is the component itself
+     * (so it's what is enlisted, created in, destroyed from, and saved).
+     * Since nothing writes the front, applying to it never makes
+     * other tasks wait, so e.g. apply(a.front(), b.front(), a.back(), f)
+     * and apply(a.front(), b.front(), b.back(), g) can run at the same time.
+     * The front is passed as ReadOnly, so f and g have to take its values
+     * as const references (and writing them doesn't compile).
+     * update applies the queued changes to the back, and then the fronts
+     * and backs trade places, i.e. the back is copied into the front
+     * (a copy rather than a swap, so that the back starts out with
+     * the current state, and entities that aren't written keep it).
+     * The copy is skipped if nothing could have changed the back since,
+     * i.e. no task used it (for writing), and nothing was created or destroyed.
+     * So write the back through apply or operator[] (of the DoubleBuffered)
+     * or call written() after changing it some other way.
+     */
+
+    DoubleBuffered() { previous.waiting_flags.read_only = true; }
+
+    ReadOnly<T> front() { return {previous}; }
+    Component<T> &back() { return *this; }
+
+    void update() {
+      Component<T>::update();
+      if (stale()) {
+        flip();
+      }
+    }
+
+    bool pending() {
+      return Component<T>::pending() || stale();
+    }
+
+    bool stale() {
+      // could the back differ from the front
+      return written_since || (previous.generation != this->generation) ||
+             (this->waiting_flags.writes != flipped_writes);
+    }
+
+    void written() { written_since = true; }
+
+    T *operator[](uint32_t key) {
+      // (the value may be written through the pointer)
+      written_since = true;
+      return Component<T>::operator[](key);
+    }
+
+    void load(const char *bytes, size_t count) {
+      Component<T>::load(bytes, count);
+      flip();
+    }
+
+    std::vector<int> waiting() {
+      auto result = this->waiting_flags.values();
+      auto readers = previous.waiting_flags.values();
+      result.insert(result.end(), readers.begin(), readers.end());
+      return result;
+    }
+
+    void clear_waiting() {
+      this->waiting_flags.clear();
+      previous.waiting_flags.clear();
+    }
+
+    MemoryStats memory() {
+      auto stats = Component<T>::memory();
+      stats.bytes += previous.memory().bytes;
+      return stats;
+    }
+
+    void shrink(const ShrinkPolicy &policy) {
+      Component<T>::shrink(policy);
+      previous.shrink(policy);
+    }
+
+    void flip() {
+      previous.data = this->data; // keeps the capacity of previous.data
+      previous.cache.fill(std::make_pair(0, nullptr));
+      previous.lazy = this->lazy;
+      previous.sorted = this->sorted;
+      previous.positions = this->positions;
+      previous.zones.build(previous.data);
+      previous.generation = this->generation;
+      flipped_writes = this->waiting_flags.writes;
+      written_since = false;
+    }
+
+    Component<T> previous;
+    uint64_t flipped_writes {0};
+    bool written_since {false};
+  };
+
+
+  struct SharedHeader {
+
+    /*
+     * The start of a shared region, followed by capacity elements.
+     * sequence is odd while the writer publishes, so a reader that sees
+     * the same even sequence before and after reading got a consistent copy
+     */
+
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> epoch; // number of publishes
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> capacity; // elements there is room for
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "shared regions need lock free atomics between processes");
+
+  const uint32_t SHARED_VERSION = 1;
+
+
+  struct SharedRegion {
+
+    /*
+     * A named POSIX shared memory object, mapped in full.
+     * The writer creates it (replacing any old one with the same name,
+     * which readers that still have it mapped keep seeing)
+     * and unlinks it when done, readers open it read only.
+     * The region only ever grows, so an old mapping stays valid,
+     * and a reader remaps when the header says there's more than it sees
+     */
+
+    SharedRegion() = default;
+    SharedRegion(const SharedRegion &) = delete;
+    SharedRegion &operator=(const SharedRegion &) = delete;
+
+    ~SharedRegion() {
+#ifdef ECSOPLATM_MMAP
+      if (data)
+        ::munmap(data, size);
+      if (fd >= 0)
+        ::close(fd);
+      if (owner)
+        ::shm_unlink(name.c_str());
+#endif
+    }
+
+    bool create(const std::string &name_, size_t size_) {
+#ifdef ECSOPLATM_MMAP
+      name = name_;
+      ::shm_unlink(name.c_str());
+      fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+      if (fd < 0)
+        return false;
+      owner = true;
+      writable = true;
+      return resize(size_);
+#else
+      (void) name_; (void) size_;
+      return false;
+#endif
+    }
+
+    bool open(const std::string &name_) {
+#ifdef ECSOPLATM_MMAP
+      name = name_;
+      fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+      if (fd < 0)
+        return false;
+      return remap();
+#else
+      (void) name_;
+      return false;
+#endif
+    }
+
+    bool resize(size_t size_) {
+      // (writer only) grow the object, and map all of it
+#ifdef ECSOPLATM_MMAP
+      if (::ftruncate(fd, size_) != 0)
+        return false;
+      return remap();
+#else
+      (void) size_;
+      return false;
+#endif
+    }
+
+    bool remap() {
+      // map the object at its current size
+#ifdef ECSOPLATM_MMAP
+      struct stat info;
+      if ((::fstat(fd, &info) != 0) ||
+          (static_cast<size_t>(info.st_size) < sizeof(SharedHeader)))
+        return false;
+      int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+      void *p = ::mmap(nullptr, info.st_size, protection, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED)
+        return false;
+      if (data)
+        ::munmap(data, size);
+      data = static_cast<char *>(p);
+      size = info.st_size;
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    SharedHeader &header() { return *reinterpret_cast<SharedHeader *>(data); }
+    char *elements() { return data + sizeof(SharedHeader); }
+
+    std::string name;
+    int fd {-1};
+    char *data {nullptr};
+    size_t size {0};
+    bool owner {false};
+    bool writable {false};
+  };
+
+
+  template <typename C> struct Shared;
+
+  template <typename T>
+  struct Shared<Component<T>> : Component<T> {
+
+    /*
+     * A component that is also published to a named shared memory region
+     * (e.g. "/positions") at the end of every update, so that other processes
+     * on the machine can read it with a SharedReader<T> without asking
+     * the simulation for anything. The data itself stays in the component,
+     * publishing is one copy of it into the region, under a seqlock
+     * (so readers never block the writer, they just retry if it was busy).
+     * If the region can't be created, the component works as usual,
+     * and is_shared() says so
+     */
+
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "only trivially copyable components can be shared");
+
+    Shared(const std::string &name) {
+      constexpr size_t INITIAL_CAPACITY = 1024;
+      if (!region.create(name, sizeof(SharedHeader) +
+                               INITIAL_CAPACITY*ELEMENT_SIZE))
+        return;
+      auto &header = *new (region.data) SharedHeader;
+      std::memcpy(header.magic, "ECSOPSHM", 8);
+      header.version = SHARED_VERSION;
+      header.element_size = ELEMENT_SIZE;
+      header.sequence = 0;
+      header.epoch = 0;
+      header.count = 0;
+      header.capacity = INITIAL_CAPACITY;
+      publish();
+    }
+
+    bool is_shared() { return region.data != nullptr; }
+
+    void update() {
+      Component<T>::update();
+      publish();
+    }
+
+    bool pending() {
+      // systems may have written the values, which readers should see
+      return is_shared() || Component<T>::pending();
+    }
+
+    void load(const char *bytes, size_t count) {
+      Component<T>::load(bytes, count);
+      publish();
+    }
+
+    bool publish() {
+      if (!is_shared())
+        return false;
+      uint64_t capacity = region.header().capacity.load(std::memory_order_relaxed);
+      if (this->data.size() > capacity) {
+        // grown before the sequence is bumped, since readers can keep reading
+        // the old part of the region while it grows
+        capacity = std::max<uint64_t>(this->data.size(), 2*capacity);
+        if (!region.resize(sizeof(SharedHeader) + capacity*ELEMENT_SIZE))
+          return false;
+        region.header().capacity.store(capacity, std::memory_order_relaxed);
+      }
+      auto &h = region.header();
+      uint64_t sequence = h.sequence.load(std::memory_order_relaxed);
+      h.sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      h.count.store(this->data.size(), std::memory_order_relaxed);
+      std::memcpy(region.elements(), static_cast<const void *>(this->data.data()),
+                  this->data.size()*ELEMENT_SIZE);
+      h.epoch.store(h.epoch.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      h.sequence.store(sequence + 2, std::memory_order_release);
+      return true;
+    }
+
+    static constexpr size_t ELEMENT_SIZE = sizeof(std::pair<uint32_t, T>);
+    SharedRegion region;
+  };
+
+
+  template <typename T>
+  struct SharedReader {
+
+    /*
+     * Reads a Shared<Component<T>> from another process (or the same one).
+     * view runs f on the elements in place (no copy), and runs it again
+     * if the writer published while it ran, so f should only look,
+     * and keep whatever it found from the last call.
+     * read copies the elements instead, so the copy is always consistent.
+     * Both give up (returning false) if the writer stays busy for
+     * max_attempts tries, e.g. because it died while publishing
+     */
+
+    SharedReader(const std::string &name) {
+      if (!region.open(name))
+        return;
+      auto &header = region.header();
+      if ((std::memcmp(header.magic, "ECSOPSHM", 8) != 0) ||
+          (header.version != SHARED_VERSION) ||
+          (header.element_size != ELEMENT_SIZE))
+        return;
+      ok = true;
+    }
+
+    bool is_open() { return ok; }
+
+    uint64_t epoch() {
+      // a cheap way to see if there's anything new
+      if (!ok)
+        return 0;
+      return region.header().epoch.load(std::memory_order_acquire);
+    }
+
+    template <typename F>
+    bool view(F f) {
+      if (!ok)
+        return false;
+      for (int attempt = 0; attempt < max_attempts; ++attempt) {
+        auto &header = region.header();
+        uint64_t before = header.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+          std::this_thread::yield();
+          continue;
+        }
+        uint64_t count = header.count.load(std::memory_order_relaxed);
+        if (sizeof(SharedHeader) + count*ELEMENT_SIZE > region.size) {
+          // the writer grew the region since we mapped it
+          if (!region.remap())
+            return false;
+          continue;
+        }
+        f(std::span<const std::pair<uint32_t, T>>(
+            reinterpret_cast<const std::pair<uint32_t, T> *>(region.elements()),
+            count));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header.sequence.load(std::memory_order_relaxed) == before)
+          return true;
+      }
+      return false;
+    }
+
+    bool read(std::vector<std::pair<uint32_t, T>> &out) {
+      return view([&out](std::span<const std::pair<uint32_t, T>> elements) {
+        out.assign(elements.begin(), elements.end());
+      });
+    }
+
+    static constexpr size_t ELEMENT_SIZE = sizeof(std::pair<uint32_t, T>);
+    SharedRegion region;
+    bool ok {false};
+    int max_attempts {1 << 16};
+  };
+
+
+  template <typename E>
+  struct EventChannel : ComponentInterface {
+
+    /*
+     * A channel of events of type E, that systems can send to each other
+     * within a frame, without creating (and sorting) any components.
+     * Events sent from a worker go into a buffer of that worker,
+     * and a consumer apply first gathers all the buffers into events.
+     * The tasks that send (producers) and read (consumers) are tracked,
+     * so that a consumer waits for everything sent before it was applied.
+     * Enlisting the channel makes update clear it, so events only
+     * live for one frame (and clearing keeps the memory for the next frame).
+     */
+
+    EventChannel() : buffers(1) {}
+
+    void send(E event) {
+      // the last buffer is for anything that isn't a worker
+      int worker = Flowpool::current_worker(pool);
+      auto &buffer = buffers[(worker >= 0) ? worker : buffers.size() - 1];
+      std::scoped_lock lock(buffer.mutex);
+      buffer.queue.push_back(std::move(event));
+    }
+
+    void gather() {
+      for (auto &buffer: buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        std::move(buffer.queue.begin(), buffer.queue.end(),
+                  std::back_inserter(events));
+        buffer.queue.clear();
+      }
+    }
+
+    void update() {
+      events.clear();
+      for (auto &buffer: buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        buffer.queue.clear();
+      }
+    }
+
+    bool exists(uint32_t) { return false; }
+
+    bool pending() {
+      if (!events.empty() || !producers.empty() || !consumers.empty())
+        return true;
+      for (auto &buffer: buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        if (!buffer.queue.empty())
+          return true;
+      }
+      return false;
+    }
+
+    void attach(const Flowpool *pool_, std::vector<Signature> *, int) {
+      // events aren't entities, so there's no signature to keep
+      pool = pool_;
+      buffers.resize(pool->size() + 1);
+    }
+
+    std::vector<int> waiting() {
+      auto result = producers;
+      result.insert(result.end(), consumers.begin(), consumers.end());
+      return result;
+    }
+
+    void clear_waiting() {
+      producers.clear();
+      consumers.clear();
+    }
+
+    MemoryStats memory() {
+      MemoryStats stats;
+      stats.size = events.size();
+      stats.capacity = events.capacity();
+      stats.bytes = events.capacity()*sizeof(E) +
+                    (producers.capacity() + consumers.capacity())*sizeof(int);
+      for (auto &buffer: buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        stats.bytes += sizeof(buffer) + buffer.queue.capacity()*sizeof(E);
+      }
+      return stats;
+    }
+
+    void shrink(const ShrinkPolicy &policy) {
+      policy.apply(events);
+      for (auto &buffer: buffers) {
+        std::scoped_lock lock(buffer.mutex);
+        policy.apply(buffer.queue);
+      }
+    }
+
+    std::vector<E> events; // everything gathered so far this frame
+    std::vector<CommandBuffer<E>> buffers;
+    std::vector<int> producers; // tasks that may send
+    std::vector<int> consumers; // tasks that read events
+  };
+
+
+  template <typename T>
+  struct Resource : ComponentInterface {
+
+    /*
+     * Some shared data that systems can read or write, like a spatial grid,
+     * where the tasks that use it are tracked like for a component,
+     * (except that the whole value is one range) so that only the systems
+     * that conflict on it (a write and anything else) wait for each other.
+     * Pass it to apply as ecs::read(r) or ecs::write(r).
+     * The blocks of a system that writes are run one after another
+     * (since they all write the same value), but can overlap
+     * with other systems that don't use the resource.
+     * To use the value from outside of apply, update it first
+     * (i.e. ecs.update(r)), which waits for the tasks that use it.
+     */
+
+    Resource() = default;
+    Resource(T value_) : value(std::move(value_)) {}
+
+    void update() {}
+    bool exists(uint32_t) { return false; }
+    bool pending() {
+      // nothing to update, the finished tasks are forgotten as new ones come
+      return false;
+    }
+
+    void attach(const Flowpool *pool_, std::vector<Signature> *, int) {
+      // not an entity component, so there's no signature to keep
+      pool = pool_;
+    }
+
+    std::vector<int> waiting() {
+      auto result = writers;
+      result.insert(result.end(), readers.begin(), readers.end());
+      return result;
+    }
+
+    void clear_waiting() {
+      readers.clear();
+      writers.clear();
+    }
+
+    T value;
+    std::vector<int> readers; // tasks that read since the last write
+    std::vector<int> writers; // the last task that wrote
+  };
+
+  template <typename T>
+  struct Read {
+    // marks a resource as read only when passed to apply
+    Resource<T> &resource;
+  };
+
+  template <typename T>
+  struct Write {
+    // marks a resource as written when passed to apply
+    Resource<T> &resource;
+  };
+
+  template <typename T>
+  Read<T> read(Resource<T> &resource) { return {resource}; }
+
+  template <typename T>
+  Write<T> write(Resource<T> &resource) { return {resource}; }
+
+
+  struct Hierarchy : Component<uint32_t> {
+
+    /*
+     * A parent relation, i.e. the value of an entity is the id of its parent.
+     * Entities that don't have a parent are roots, and are not in here.
+     * Whenever update changes the structure, the children are also sorted
+     * by their depth (how many ancestors they have), into order
+     * so that a level can be processed once the level before it is done.
+     * Entities in a cycle have no depth, and are left out of order.
+     * Changing the value of a parent in place isn't noticed,
+     * so use reparent (which is a destroy and a create) instead.
+     */
+
+    void update() {
+      Component<uint32_t>::update();
+      ensure_sorted(); // the levels are found by binary search
+      if (sorted_generation != generation) {
+        sort_levels();
+      }
+    }
+
+    void load(const char *bytes, size_t count) {
+      Component<uint32_t>::load(bytes, count);
+      sort_levels();
+    }
+
+    void reparent(uint32_t child, uint32_t parent) {
+      destroy(child);
+      create(child, parent);
+    }
+
+    size_t depth() const { return levels.size() - 1; }
+
+    void sort_levels() {
+      const int VISITING = -2;
+      const int CYCLE = -3;
+      size_t n = data.size();
+      std::vector<int> depths(n, -1);
+      std::vector<size_t> path;
+      auto find = [this](uint32_t id) {
+        auto it = std::lower_bound(data.begin(), data.end(), id,
+                                   [](const std::pair<uint32_t, uint32_t> &a,
+                                      uint32_t b) { return a.first < b; });
+        return ((it != data.end()) && (it->first == id)) ?
+          static_cast<size_t>(it - data.begin()) : data.size();
+      };
+
+      // walk up from every entity until an ancestor with known depth
+      // (or a root) and then give the depths to everything on the way back
+      for (size_t i = 0; i < n; ++i) {
+        size_t j = i;
+        int d = -1; // the depth of a root
+        while (depths[j] == -1) {
+          depths[j] = VISITING;
+          path.push_back(j);
+          j = find(data[j].second);
+          if (j == n)
+            break;
+        }
+        if (j != n) {
+          d = (depths[j] < -1) ? CYCLE : depths[j];
+        }
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+          d = (d == CYCLE) ? CYCLE : d + 1;
+          depths[*it] = d;
+        }
+        path.clear();
+      }
+
+      // then a counting sort by depth, which keeps each level sorted by id
+      levels.assign(1, 0);
+      for (auto d: depths) {
+        if (d < 0)
+          continue;
+        if (levels.size() < static_cast<size_t>(d) + 2) {
+          levels.resize(d + 2, 0);
+        }
+        ++levels[d + 1];
+      }
+      for (size_t k = 1; k < levels.size(); ++k) {
+        levels[k] += levels[k - 1];
+      }
+      order.resize(levels.back());
+      std::vector<size_t> at(levels.begin(), levels.end() - 1);
+      for (size_t i = 0; i < n; ++i) {
+        if (depths[i] >= 0) {
+          order[at[depths[i]]++] = data[i];
+        }
+      }
+      sorted_generation = generation;
+    }
+
+    // (child, parent) by depth, where level k is [levels[k], levels[k + 1])
+    std::vector<std::pair<uint32_t, uint32_t>> order;
+    std::vector<size_t> levels {0};
+    uint64_t sorted_generation {0};
+  };
+
+
+  template <typename... T>
+  struct Query {
+
+    /*
+     * A query stores which entities have all of the components
+     * as a list of indices into the data of each component.
+     * Since data only changes structurally in update, the list stays valid
+     * until one of the components is updated, and is only rebuilt then.
+     * Applying a function to a query is then just an indexed loop
+     * that is split into perfectly balanced blocks.
+     */
+
+    static const size_t N = sizeof...(T);
+
+    Query(Component<T> &... components_)
+      : components(components_...) {
+      generations.fill(-1);
+    }
+
+    bool stale() {
+      return [&]<size_t... I>(std::index_sequence<I...>) {
+        return ((generations[I] != std::get<I>(components).generation) || ...);
+      }(std::index_sequence_for<T...>{});
+    }
+
+    void build() {
+      matches.clear();
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        generations = {std::get<I>(components).generation...};
+        // a merge join, where all the lists are skipped forward
+        // to the highest current id, until they all agree
+        std::array<uint32_t, N> at {};
+        while (((at[I] < std::get<I>(components).data.size()) && ...)) {
+          uint32_t id = std::max({std::get<I>(components).data[at[I]].first...});
+          bool match = true;
+          ((std::get<I>(components).data[at[I]].first < id ?
+            (at[I] = seek(std::get<I>(components), at[I], id), match = false) :
+            false), ...);
+          if (match) {
+            matches.push_back(at);
+            (++at[I], ...);
+          }
+        }
+      }(std::index_sequence_for<T...>{});
+    }
+
+    template <typename U>
+    static uint32_t seek(Component<U> &c, uint32_t at, uint32_t id) {
+      return std::lower_bound(c.data.begin() + at, c.data.end(), id,
+                              [](const std::pair<uint32_t, U> &a, uint32_t b) {
+                                return a.first < b;
+                              }) - c.data.begin();
+    }
+
+    std::tuple<Component<T> &...> components;
+    std::array<uint64_t, N> generations;
+    std::vector<std::array<uint32_t, N>> matches;
+  };
+
+
+  struct MappedFile {
+
+    /*
+     * A read only view of a whole file, that is memory mapped if possible
+     * (and otherwise just read into memory)
+     */
+
+    MappedFile(const std::string &path) {
+#ifdef ECSOPLATM_MMAP
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        return;
+      struct stat info;
+      if ((::fstat(fd, &info) == 0) && (info.st_size > 0)) {
+        void *p = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+          data = static_cast<const char *>(p);
+          size = info.st_size;
+        }
+      }
+      ::close(fd);
+#else
+      std::ifstream in(path, std::ios::binary);
+      buffer.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+      data = buffer.data();
+      size = buffer.size();
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef ECSOPLATM_MMAP
+      if (data)
+        ::munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    template <typename U>
+    bool read(size_t &at, U &value) const {
+      // read a U at offset at, and move past it
+      if (at + sizeof(U) > size)
+        return false;
+      std::memcpy(&value, data + at, sizeof(U));
+      at += sizeof(U);
+      return true;
+    }
+
+    const char *data {nullptr};
+    size_t size {0};
+#ifndef ECSOPLATM_MMAP
+    std::vector<char> buffer;
+#endif
+  };
+
+
+  const uint32_t SNAPSHOT_VERSION = 3;
+
+  struct SnapshotHeader {
+
+    /*
+     * The format is the native one (it's meant to be loaded on the same kind
+     * of machine, by the same program), and is like
+     *   "ECSOPLTM" u32 version u64 frame u32 max_unused_id
+     *   u32 n_unused_ids u32[n_unused_ids]
+     *   u32 n_components
+     * followed by n_components SnapshotEntry
+     */
+
+    uint64_t frame;
+    uint32_t max_unused_id;
+    std::vector<uint32_t> unused_ids;
+    uint32_t n_components;
+
+    void write(std::ostream &out) const {
+      auto write = [&out](const auto &value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      };
+      out.write("ECSOPLTM", 8);
+      write(SNAPSHOT_VERSION);
+      write(frame);
+      write(max_unused_id);
+      write(static_cast<uint32_t>(unused_ids.size()));
+      out.write(reinterpret_cast<const char *>(unused_ids.data()),
+                unused_ids.size()*sizeof(uint32_t));
+      write(n_components);
+    }
+
+    bool read(const MappedFile &file, size_t &at) {
+      uint32_t version, n_unused;
+      if (!file.data || (file.size < at + 8) ||
+          (std::memcmp(file.data + at, "ECSOPLTM", 8) != 0))
+        return false;
+      at += 8;
+      if (!file.read(at, version) || (version != SNAPSHOT_VERSION) ||
+          !file.read(at, frame) || !file.read(at, max_unused_id) ||
+          !file.read(at, n_unused) ||
+          (n_unused > (file.size - at)/sizeof(uint32_t)))
+        return false;
+      unused_ids.resize(n_unused);
+      for (auto &id: unused_ids) {
+        if (!file.read(at, id))
+          return false;
+      }
+      return file.read(at, n_components);
+    }
+  };
+
+
+  struct SnapshotEntry {
+
+    /*
+     * One component in a snapshot, like
+     *   u32 name_length char[name_length] u32 element_size u64 count
+     *   (padding to 64) element_size*count bytes
+     * where the bytes are the raw data array of the component.
+     * When read, bytes points into the file
+     */
+
+    std::string name;
+    uint32_t element_size;
+    uint64_t count;
+    const char *bytes;
+
+    void write(std::ostream &out) const {
+      auto write = [&out](const auto &value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      };
+      write(static_cast<uint32_t>(name.size()));
+      out.write(name.data(), name.size());
+      write(element_size);
+      write(count);
+      while (out.tellp() % CACHE_LINE != 0) {
+        out.put(0);
+      }
+      out.write(bytes, element_size*count);
+    }
+
+    bool read(const MappedFile &file, size_t &at) {
+      uint32_t name_length;
+      // (the sizes are checked by division, since a broken count
+      // could make the product overflow)
+      if (!file.read(at, name_length) || (name_length > file.size - at))
+        return false;
+      name.assign(file.data + at, name_length);
+      at += name_length;
+      if (!file.read(at, element_size) || !file.read(at, count))
+        return false;
+      at = (at + CACHE_LINE - 1)/CACHE_LINE*CACHE_LINE;
+      if ((at > file.size) ||
+          ((element_size > 0) && (count > (file.size - at)/element_size)))
+        return false;
+      bytes = file.data + at;
+      at += element_size*count;
+      return true;
+    }
+  };
+
+
+  struct Journal {
+
+    /*
+     * An append only file of what update changed in each component,
+     * one record per component and frame, like
+     *   u64 frame u32 name_length char[name_length] u32 element_size
+     *   u64 n_modified element_size*n_modified bytes
+     *   u64 n_destroyed u32[n_destroyed]
+     *   u64 n_created element_size*n_created bytes
+     * where the elements are raw (id, value) like in a snapshot.
+     * Everything is sorted by id, and should be applied in that order
+     * (modified, destroyed, created), which is how update does it.
+     * See rebuild_snapshot for how to use it.
+     */
+
+    struct Record {
+      // a record as read from a file, the pointers point into the file
+      uint64_t frame;
+      std::string name;
+      uint32_t element_size;
+      uint64_t n_modified;
+      const char *modified;
+      uint64_t n_destroyed;
+      const char *destroyed; // u32 ids, but not necessarily aligned
+      uint64_t n_created;
+      const char *created;
+
+      bool read(const MappedFile &file, size_t &at) {
+        auto span = [&](uint64_t &n, const char *&bytes, size_t size) {
+          // (checked by division, like SnapshotEntry::read)
+          if (!file.read(at, n) || (n > (file.size - at)/size))
+            return false;
+          bytes = file.data + at;
+          at += n*size;
+          return true;
+        };
+        uint32_t name_length;
+        if (!file.read(at, frame) || !file.read(at, name_length) ||
+            (name_length > file.size - at))
+          return false;
+        name.assign(file.data + at, name_length);
+        at += name_length;
+        return file.read(at, element_size) && (element_size > 0) &&
+               span(n_modified, modified, element_size) &&
+               span(n_destroyed, destroyed, sizeof(uint32_t)) &&
+               span(n_created, created, element_size);
+      }
+    };
+
+    Journal(const std::string &path)
+      : out(path, std::ios::binary | std::ios::app) {}
+
+    void write(uint64_t frame, const std::string &name, size_t element_size,
+               const Delta &delta) {
+      if (element_size == 0)
+        return; // can't be stored
+      auto write = [this](const auto &value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      };
+      write(frame);
+      write(static_cast<uint32_t>(name.size()));
+      out.write(name.data(), name.size());
+      write(static_cast<uint32_t>(element_size));
+      write(static_cast<uint64_t>(delta.modified.size()/element_size));
+      out.write(delta.modified.data(), delta.modified.size());
+      write(static_cast<uint64_t>(delta.destroyed.size()));
+      out.write(reinterpret_cast<const char *>(delta.destroyed.data()),
+                delta.destroyed.size()*sizeof(uint32_t));
+      write(static_cast<uint64_t>(delta.created.size()/element_size));
+      out.write(delta.created.data(), delta.created.size());
+    }
+
+    void flush() { out.flush(); }
+
+    std::ofstream out;
+  };
+
+
+  inline bool rebuild_snapshot(const std::string &base_path,
+                               const std::string &journal_path,
+                               uint64_t target,
+                               const std::string &out_path) {
+
+    /*
+     * Writes the snapshot of frame target, given a snapshot from before
+     * that, and a journal covering the frames in between
+     * (the updates of the snapshot's frame up to, but not including, target).
+     * It works on the raw bytes, so it doesn't need to know the types.
+     * Entity ids created since the snapshot are taken out of the unused ids
+     * (but ids returned since then are not known, so they stay used).
+     */
+
+    MappedFile base(base_path);
+    MappedFile journal(journal_path);
+    size_t at = 0;
+    SnapshotHeader header;
+    if (!header.read(base, at) || !journal.data)
+      return false;
+
+    auto id_of = [](const char *bytes) {
+      uint32_t id;
+      std::memcpy(&id, bytes, sizeof(id));
+      return id;
+    };
+
+    std::vector<SnapshotEntry> entries(header.n_components);
+    std::vector<std::vector<char>> bytes(header.n_components);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (!entries[i].read(base, at))
+        return false;
+      bytes[i].assign(entries[i].bytes,
+                      entries[i].bytes + entries[i].element_size*entries[i].count);
+    }
+
+    at = 0;
+    Journal::Record record;
+    while (at < journal.size) {
+      if (!record.read(journal, at))
+        return false;
+      if ((record.frame < header.frame) || (record.frame >= target))
+        continue;
+      auto it = std::find_if(entries.begin(), entries.end(),
+                             [&](const SnapshotEntry &entry) {
+                               return entry.name == record.name;
+                             });
+      if ((it == entries.end()) || (it->element_size != record.element_size))
+        continue; // not in the snapshot (or not the same), so can't be applied
+      auto &from = bytes[it - entries.begin()];
+      const size_t es = record.element_size;
+      const size_t n = from.size()/es;
+
+      // modified elements are overwritten in place
+      size_t i = 0;
+      for (uint64_t k = 0; k < record.n_modified; ++k) {
+        const char *e = record.modified + k*es;
+        while ((i < n) && (id_of(from.data() + i*es) < id_of(e))) {
+          ++i;
+        }
+        if ((i < n) && (id_of(from.data() + i*es) == id_of(e))) {
+          std::memcpy(from.data() + i*es, e, es);
+        }
+      }
+
+      // then destroyed and created elements are merged in, in one pass
+      std::vector<char> to;
+      to.reserve(from.size() + record.n_created*es);
+      uint64_t d = 0, c = 0;
+      for (i = 0; i <= n; ++i) {
+        uint32_t id = (i < n) ? id_of(from.data() + i*es) : UINT32_MAX;
+        while ((c < record.n_created) &&
+               ((i == n) || (id_of(record.created + c*es) < id))) {
+          uint32_t created = id_of(record.created + c*es);
+          header.max_unused_id = std::max(header.max_unused_id, created + 1);
+          std::erase(header.unused_ids, created);
+          to.insert(to.end(), record.created + c*es,
+                    record.created + (c + 1)*es);
+          ++c;
+        }
+        if (i == n)
+          break;
+        while ((d < record.n_destroyed) &&
+               (id_of(record.destroyed + d*sizeof(uint32_t)) < id)) {
+          ++d;
+        }
+        if ((d < record.n_destroyed) &&
+            (id_of(record.destroyed + d*sizeof(uint32_t)) == id))
+          continue;
+        to.insert(to.end(), from.begin() + i*es, from.begin() + (i + 1)*es);
+      }
+      from = std::move(to);
+    }
+
+    std::ofstream out(out_path, std::ios::binary);
+    header.frame = target;
+    header.write(out);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      entries[i].count = bytes[i].size()/entries[i].element_size;
+      entries[i].bytes = bytes[i].data();
+      entries[i].write(out);
+    }
+    return out.good();
+  }
+
+
+  struct CallStats {
+    // what the applies of one function did, summed over all of them
+    std::string name; // the system that applied it, or its address
+    std::string site; // file:line, if the applies were tagged (see at)
+    uint64_t calls;
+    uint64_t blocks; // tasks (including those that gather or combine)
+    uint64_t visited; // elements the tasks stepped through (not skipped)
+    uint64_t matched; // times the function was run
+    double schedule; // seconds spent in apply, i.e. splitting and pushing
+    double execute; // seconds spent running the tasks, on all workers
+    double queued; // seconds from a task being pushed until it started
+  };
+
+
+  struct Async {
+
+    /*
+     * The return type of a system that is a coroutine (see Manager::fence)
+     * it runs on its own once called, and wait blocks until it's finished
+     * (and rethrows anything it threw)
+     */
+
+    struct promise_type {
+      std::promise<void> finished;
+
+      Async get_return_object() { return Async {finished.get_future()}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() { finished.set_value(); }
+      void unhandled_exception() {
+        finished.set_exception(std::current_exception());
+      }
+    };
+
+    void wait() { finished.get(); }
+
+    std::future<void> finished;
+  };
+
+
+  struct Manager;
+
+  struct System {
+    // a function that calls apply, along with what components it uses
+    std::string name;
+    std::vector<ComponentInterface *> reads;
+    std::vector<ComponentInterface *> writes;
+    std::function<void(Manager &)> run;
+
+    static bool touches(const std::vector<ComponentInterface *> &list,
+                        ComponentInterface *c) {
+      return std::find(list.begin(), list.end(), c) != list.end();
+    }
+
+    bool uses(ComponentInterface *c) const {
+      return touches(reads, c) || touches(writes, c);
+    }
+
+    bool conflicts(const System &other) const {
+      for (auto c: writes) {
+        if (touches(other.reads, c) || touches(other.writes, c))
+          return true;
+      }
+      for (auto c: reads) {
+        if (touches(other.writes, c))
+          return true;
+      }
+      return false;
+    }
+  };
+
+
+  struct Manager {
+
+    /*
+     * This class is how to interact with the entity components
+     * and how to build systems that work with them in parallel.
+     * The main functionality are the apply functions
+     * which take a function and applies it to all entities that
+     * have the required components.
+     */
+
+    uint32_t max_unused_id {1}; // 0 is no entity by definition
+    // held while scheduling, since async systems schedule from the workers
+    // (and declared before the pool, so they outlive its tasks)
+    std::recursive_mutex scheduling;
+    std::condition_variable_any async_done;
+    int n_async {0}; // async systems that are waiting for, or running on, the pool
+    Flowpool pool;
+    std::vector<ComponentInterface *> components;
+    std::vector<std::string> component_names; // used for debug features
+    std::vector<uint32_t> unused_ids;
+    std::vector<Signature> signatures; // which components each entity has
+    uint64_t frame {0}; // number of updates, used by snapshots and journals
+    size_t frames_ahead {2}; // how many frames' tasks may run behind update
+    std::deque<int> frame_ends; // the first task id after each of those frames
+    ShrinkPolicy shrink_policy; // off by default, see ShrinkPolicy
+    Journal *journal {nullptr};
+    std::vector<System> systems;
+    std::vector<std::vector<int>> stages; // indices into systems, see schedule
+
+    // statistics per applied function (and call site, see at)
+    struct CallSite {
+      void (*function)();
+      std::string_view file;
+      uint32_t line;
+      bool operator<(const CallSite &other) const {
+        if (function != other.function)
+          return std::less<void (*)()>{}(function, other.function);
+        return std::tie(file, line) < std::tie(other.file, other.line);
+      }
+    };
+    struct Counters {
+      std::string name;
+      uint64_t calls {0};
+      uint64_t blocks {0};
+      uint64_t schedule {0}; // nanoseconds, as are the others
+      // (these are counted by the tasks, and the rest while scheduling)
+      std::atomic<uint64_t> visited {0};
+      std::atomic<uint64_t> matched {0};
+      std::atomic<uint64_t> execute {0};
+      std::atomic<uint64_t> queued {0};
+    };
+    bool collect_stats {true};
+    std::map<CallSite, Counters> counters;
+    Counters *call {nullptr}; // of the apply that is scheduling
+    const std::string *current_system {nullptr};
+    static inline thread_local uint64_t matches {0}; // by the running task
+    static inline thread_local CallSite next_site {}; // see at
+
+    Manager() {}
+    Manager(int n_threads)
+      : pool(n_threads) {}
+
+    uint32_t get_id() {
+
+      /*
+       * Get a new entity id
+       */
+
+      std::scoped_lock lock(scheduling);
+      uint32_t id = max_unused_id;
+      if (!unused_ids.empty()) {
+        id = unused_ids.back();
+        unused_ids.pop_back();
+      } else {
+        ++max_unused_id;
+      }
+      return id;
+    }
+
+    IdRange get_ids(uint32_t n) {
+      // get n new entity ids, that are guaranteed to be contiguous
+      // (so unused ids are not reused here)
+      // if there aren't n ids left, the range is shorter, so check its size
+      std::scoped_lock lock(scheduling);
+      n = std::min(n, std::numeric_limits<uint32_t>::max() - max_unused_id);
+      IdRange ids {max_unused_id, max_unused_id + n};
+      max_unused_id += n;
+      return ids;
+    }
+
+    void return_id(uint32_t id) {
+      std::scoped_lock lock(scheduling);
+      unused_ids.push_back(id);
+    }
+
+    template <typename T> void enlist(Component<T> *component) {
+      enlist(component, "UNKNOWN");
+    }
+
+    template <typename T> void enlist(Resource<T> *resource) {
+      enlist(resource, "UNKNOWN");
+    }
+
+    template <typename T> void enlist(Resource<T> *resource, std::string name) {
+      resource->attach(&pool, &signatures, -1);
+      components.push_back(resource);
+      component_names.push_back(name);
+    }
+
+    template <typename E> void enlist(EventChannel<E> *channel) {
+      enlist(channel, "UNKNOWN");
+    }
+
+    template <typename E> void enlist(EventChannel<E> *channel, std::string name) {
+      channel->attach(&pool, &signatures, -1);
+      components.push_back(channel);
+      component_names.push_back(name);
+    }
+
+    template <typename T> void enlist(Component<T> *component, std::string name) {
+      component->attach(&pool, &signatures, components.size());
+      component->set_journaled(journal != nullptr);
+      components.push_back(component);
+      component_names.push_back(name);
+    }
+
+    bool has(uint32_t id, ComponentInterface &component) {
+      // does the entity have the component, as of the last update
+      if (component.index < 0)
+        return component.exists(id); // not tracked, so look it up
+      return (id < signatures.size()) && signatures[id][component.index];
+    }
+
+    void debug_print_entity_components(uint32_t id) {
+      std::cout << id << " : ";
+      // print what components an entity has
+      for (size_t i = 0; i < components.size(); ++i) {
+        if (has(id, *components[i])) {
+          std::cout << component_names[i] << ' ';
+        }
+      }
+      std::cout << std::endl;
+    }
+
+    void update() {
+      /*
+       * Updating a component invalidates the iterators held by tasks
+       * that use it, so it first waits for those tasks (but only those).
+       * Thus there's no need to wait() before updating, and tasks that
+       * don't touch the updated components keep running meanwhile.
+       * Components with nothing to update are skipped entirely.
+       * Note that apply looks at the current layout of the component
+       * when splitting it into tasks, so the update itself can't be deferred.
+       * Async systems can still schedule things, so update waits for them.
+       */
+      wait_async();
+      for (auto c : components) {
+        update_component(*c);
+      }
+      finish_update();
+    }
+
+    void finish_update() {
+      // what update does after the components are updated
+      if (journal) {
+        journal->flush();
+      }
+      ++frame;
+      // if nothing else is running, take the chance to clear the task list
+      if (pool.reset_if_idle()) {
+        clear_flags();
+        frame_ends.clear();
+        pool.shrink(shrink_policy);
+        return;
+      }
+      // otherwise, tasks of earlier frames are still running, which is fine
+      // (the pool forgets them as they finish) but the main thread shouldn't
+      // queue frames faster than they're done, so it waits for all the tasks
+      // of the frame that's frames_ahead frames back
+      frame_ends.push_back(pool.next_id());
+      while (frame_ends.size() > frames_ahead) {
+        pool.wait_for_all_before(frame_ends.front());
+        frame_ends.pop_front();
+      }
+    }
+
+    void update(ComponentInterface &component) {
+      // update only one component, waiting only for the tasks that use it
+      // (even if there's nothing to update, so that it can be used after)
+      wait_async();
+      if (!component.pending()) {
+        pool.wait_for(component.waiting());
+        return;
+      }
+      update_component(component);
+    }
+
+    void update_component(ComponentInterface &component) {
+      // what update does for each component (see also World::update_component)
+      if (!component.pending())
+        return;
+      pool.wait_for(component.waiting());
+      component.clear_waiting();
+      component.update();
+      write_journal(component);
+      // nothing uses the component now, so it can be reallocated
+      component.shrink(shrink_policy);
+    }
+
+    void destroy(uint32_t id) {
+      /*
+       * Note that this also marks the entity id as unused
+       * Only the components that the entity has are touched
+       */
+      for (auto c : components) {
+        if (has(id, *c)) {
+          c->destroy(id);
+        }
       }
       return_id(id);
     }
 
-    void wait() {
-      pool.wait_for_tasks();
-      for (auto c : components) {
-        c->waiting_flags.data.clear();
+    void wait() {
+      // (an async system is always in a task, so this waits for them too)
+      pool.wait_for_tasks();
+      clear_flags();
+      frame_ends.clear();
+    }
+
+    /*
+     * Systems can be written as coroutines, that return ecs::Async
+     * and co_await a fence, like
+     *   ecs::Async foo(ecs::Manager &ecs) {
+     *     auto total = ecs.apply_accumulate(a, 0, &sum);
+     *     co_await ecs.fence(a);
+     *     if (total.get() > 10) ecs.apply(a, &bar);
+     *   }
+     * The coroutine is then resumed on a worker once the tasks that use
+     * the fenced components are done, and the main thread (and the pool)
+     * keep going meanwhile. co_await ecs.fence() waits for every component.
+     * Don't wait() or update() from within a coroutine, since those wait
+     * for the coroutine itself.
+     */
+
+    struct Fence {
+      Manager &manager;
+      std::vector<int> wait;
+
+      bool await_ready() { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        manager.resume_after(handle, wait);
+      }
+      void await_resume() {}
+    };
+
+    template <typename... C>
+    Fence fence(C &... fenced) {
+      std::scoped_lock lock(scheduling);
+      std::vector<int> wait;
+      auto add_wait = [&wait](ComponentInterface &c) {
+        auto flags = c.waiting();
+        wait.insert(wait.end(), flags.begin(), flags.end());
+      };
+      if constexpr (sizeof...(C) == 0) {
+        for (auto c: components) {
+          add_wait(*c);
+        }
+      } else {
+        (add_wait(fenced), ...);
+      }
+      return Fence {*this, std::move(wait)};
+    }
+
+    void wait_async() {
+      std::unique_lock lock(scheduling);
+      async_done.wait(lock, [this]() { return n_async == 0; });
+    }
+
+    void resume_after(std::coroutine_handle<> handle,
+                      const std::vector<int> &wait) {
+      std::scoped_lock lock(scheduling);
+      ++n_async;
+      pool.push_task([this, handle]() {
+        // scheduling isn't held while the coroutine runs, only by the calls
+        // it makes (apply, get_id...), so it can block in those
+        // without holding up the main thread or other coroutines
+        handle.resume();
+        std::scoped_lock lock(scheduling);
+        --n_async;
+        async_done.notify_all();
+      }, wait);
+    }
+
+    void clear_flags() {
+      // forget about tasks in the pool, only valid when the pool is reset
+      for (auto c : components) {
+        c->clear_waiting();
+      }
+    }
+
+    /*
+     * Snapshots store the entity ids and all the enlisted components
+     * (that are trivially copyable) in a binary file, where every component
+     * is stored under its enlist name, as its raw data array.
+     * So loading is a memory map and one copy per component
+     * (straight from the map, since the arrays are aligned in the file),
+     * no create or sort involved. See SnapshotHeader for the format.
+     * Both wait for all tasks first, and return false if something failed.
+     * So the names have to tell the components apart: save refuses
+     * components that weren't named (or share a name), and load matches
+     * every entry in the file to exactly one component.
+     * Load only replaces the components that are in the file.
+     * The frame (the number of updates so far) is stored too,
+     * so a journal can be replayed on top, from the update of that frame.
+     */
+
+    bool save(const std::string &path) {
+      wait();
+      for (size_t i = 0; i < components.size(); ++i) {
+        if (components[i]->element_size() == 0)
+          continue;
+        if ((component_names[i] == "UNKNOWN") ||
+            (stored_names(component_names[i]) > 1))
+          return false;
+      }
+      for (auto c: components) {
+        c->ensure_sorted(); // snapshots are merged with journals by id
+      }
+      std::ofstream out(path, std::ios::binary);
+      SnapshotHeader header {frame, max_unused_id, unused_ids, 0};
+      for (auto c: components) {
+        header.n_components += c->element_size() > 0;
+      }
+      header.write(out);
+      for (size_t i = 0; i < components.size(); ++i) {
+        auto c = components[i];
+        if (c->element_size() == 0)
+          continue; // can't be stored
+        SnapshotEntry {component_names[i],
+                       static_cast<uint32_t>(c->element_size()),
+                       c->count(), c->bytes()}.write(out);
+      }
+      return out.good();
+    }
+
+    bool load(const std::string &path) {
+      wait();
+      MappedFile file(path);
+      size_t at = 0;
+      SnapshotHeader header;
+      if (!header.read(file, at))
+        return false;
+
+      // the whole file is checked before anything is replaced
+      // so a broken (or mismatched) snapshot leaves everything as it was
+      std::vector<std::pair<ComponentInterface *, SnapshotEntry>> loads;
+      for (uint32_t k = 0; k < header.n_components; ++k) {
+        SnapshotEntry entry;
+        if (!entry.read(file, at))
+          return false;
+        // (only components that can be stored are matched)
+        ComponentInterface *c = nullptr;
+        for (size_t i = 0; i < components.size(); ++i) {
+          if ((component_names[i] != entry.name) ||
+              (components[i]->element_size() == 0))
+            continue;
+          if (c)
+            return false; // can't tell which component it is
+          c = components[i];
+        }
+        if (c) {
+          if (c->element_size() != entry.element_size)
+            return false; // not the same type
+          for (auto &[loaded, _]: loads) {
+            if (loaded == c)
+              return false; // the file has the component twice
+          }
+          loads.emplace_back(c, entry);
+        }
+      }
+
+      max_unused_id = header.max_unused_id;
+      unused_ids = header.unused_ids;
+      frame = header.frame;
+      for (auto &[c, entry]: loads) {
+        c->load(entry.bytes, entry.count);
+      }
+      return true;
+    }
+
+    size_t stored_names(const std::string &name) {
+      // how many of the components that snapshots store have this name
+      size_t count = 0;
+      for (size_t i = 0; i < components.size(); ++i) {
+        count += (component_names[i] == name) &&
+                 (components[i]->element_size() > 0);
+      }
+      return count;
+    }
+
+    /*
+     * With a journal, every update writes what it changed in each component
+     * (see Journal). Use set_track_changes on a component to also record
+     * the values that systems changed, not only creation and destruction.
+     */
+
+    void record(Journal *journal_) {
+      // waits for all tasks first, since tracked components copy their data
+      wait();
+      journal = journal_;
+      for (auto c: components) {
+        c->set_journaled(journal != nullptr);
+      }
+    }
+
+    void write_journal(ComponentInterface &component) {
+      if (!journal || component.delta.empty())
+        return;
+      auto it = std::find(components.begin(), components.end(), &component);
+      if (it == components.end())
+        return; // not enlisted, so it has no name
+      journal->write(frame, component_names[it - components.begin()],
+                     component.element_size(), component.delta);
+    }
+
+    /*
+     * Systems can also be registered, along with what components they
+     * read and write, and then all run by run_systems.
+     * They're run in stages, where no two systems in the same stage
+     * conflict (one writes something the other reads or writes).
+     * Systems that conflict keep the order they were registered in.
+     * The schedule is only computed again if a system is added.
+     * The systems themselves run one after another, since all they do
+     * is schedule tasks, and it's the tasks that overlap: while a system
+     * runs, the components it only reads are tracked as read,
+     * so the tasks of systems that only read the same components
+     * don't wait for each other (while anything else still waits for
+     * the tasks that wrote them, and a later write for all the reads).
+     * Within a chain of conflicting systems, the waiting flags still
+     * let the blocks that don't overlap run concurrently.
+     * run_systems returns false if a system applied to an enlisted
+     * component that it didn't declare (which is then tracked as written,
+     * so it's still safe, but the schedule may have been wrong).
+     */
+
+    void add_system(std::string name,
+                    std::vector<ComponentInterface *> reads,
+                    std::vector<ComponentInterface *> writes,
+                    std::function<void(Manager &)> run) {
+      systems.push_back({name, reads, writes, run});
+      stages.clear();
+    }
+
+    const std::vector<std::vector<int>> &schedule() {
+      if (!stages.empty() || systems.empty())
+        return stages;
+      // every system goes in the stage after the last one it conflicts with
+      std::vector<int> stage(systems.size(), 0);
+      for (size_t i = 0; i < systems.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+          if (systems[i].conflicts(systems[j])) {
+            stage[i] = std::max(stage[i], stage[j] + 1);
+          }
+        }
+        if (static_cast<size_t>(stage[i]) >= stages.size()) {
+          stages.resize(stage[i] + 1);
+        }
+        stages[stage[i]].push_back(i);
+      }
+      return stages;
+    }
+
+    bool run_systems() {
+      std::scoped_lock lock(scheduling);
+      bool declared = true;
+      for (auto &stage: schedule()) {
+        for (auto i: stage) {
+          auto &system = systems[i];
+          for (auto c: components) {
+            c->waiting_flags.touched = false;
+          }
+          for (auto c: system.reads) {
+            c->waiting_flags.reading = !System::touches(system.writes, c);
+            // (the finished readers would pile up otherwise)
+            pool.forget_done(c->waiting_flags.reads);
+          }
+          current_system = &system.name;
+          system.run(*this);
+          current_system = nullptr;
+          for (auto c: system.reads) {
+            c->waiting_flags.reading = false;
+          }
+          for (auto c: components) {
+            if (c->waiting_flags.touched && !system.uses(c)) {
+              declared = false;
+            }
+          }
+        }
+      }
+      return declared;
+    }
+
+    /*
+     * Every apply is counted (unless collect_stats is off) under
+     * the function that was applied, so that badly partitioned systems
+     * (few blocks, or few matched of the visited) or systems that mostly wait
+     * for others (queued much longer than executed) can be found.
+     * The same function applied in different places can be told apart
+     * by tagging the applies with their call site, like
+     *   ecs.at().apply(a, &foo);
+     * The counting is a few clock reads per task, so it can be left on.
+     */
+
+    Manager &at(std::source_location where = std::source_location::current()) {
+      // count the next apply (on this thread) under where it was called from
+      next_site.file = where.file_name();
+      next_site.line = where.line();
+      return *this;
+    }
+
+    std::vector<CallStats> stats() {
+      std::scoped_lock lock(scheduling);
+      std::vector<CallStats> result;
+      for (auto &[site, c]: counters) {
+        auto s = call_stats(site, c);
+        if (s.name.empty()) {
+          std::stringstream address;
+          address << std::hex << "0x"
+                  << reinterpret_cast<uintptr_t>(site.function);
+          s.name = address.str();
+        }
+        result.push_back(s);
+      }
+      return result;
+    }
+
+    template <typename F>
+    CallStats stats(F f) {
+      // the stats of one function, summed over all of its call sites
+      std::scoped_lock lock(scheduling);
+      CallStats total {};
+      bool found = false;
+      for (auto &[site, c]: counters) {
+        if (site.function != reinterpret_cast<void (*)()>(f))
+          continue;
+        auto s = call_stats(site, c);
+        if (!found) {
+          found = true;
+          total.name = s.name;
+          total.site = s.site;
+        } else if (total.site != s.site) {
+          total.site.clear(); // more than one
+        }
+        total.calls += s.calls;
+        total.blocks += s.blocks;
+        total.visited += s.visited;
+        total.matched += s.matched;
+        total.schedule += s.schedule;
+        total.execute += s.execute;
+        total.queued += s.queued;
+      }
+      return total;
+    }
+
+    static CallStats call_stats(const CallSite &site, const Counters &c) {
+      std::string where;
+      if (!site.file.empty()) {
+        where = std::string(site.file) + ':' + std::to_string(site.line);
+      }
+      return {c.name, where, c.calls, c.blocks, c.visited, c.matched,
+              c.schedule*1e-9, c.execute*1e-9, c.queued*1e-9};
+    }
+
+    double utilization() { return pool.utilization(); }
+
+    void reset_stats() {
+      // (the counters are zeroed, not erased, since tasks may still use them)
+      std::scoped_lock lock(scheduling);
+      for (auto &[site, c]: counters) {
+        c.calls = c.blocks = c.schedule = 0;
+        c.visited = c.matched = c.execute = c.queued = 0;
+      }
+      pool.reset_utilization();
+    }
+
+    void debug_print_stats() {
+      for (auto &s: stats()) {
+        std::cout << s.name << (s.site.empty() ? "" : " at ") << s.site
+                  << " : " << s.calls << " calls " << s.blocks
+                  << " blocks " << s.matched << '/' << s.visited
+                  << " matched " << s.schedule << "s schedule " << s.execute
+                  << "s execute " << s.queued << "s queued" << std::endl;
+      }
+      std::cout << "utilization : " << utilization() << std::endl;
+    }
+
+    template <typename... T>
+    void sort_lazy(Component<T> &... c) {
+      // joins need sorted data, so lazy components are sorted first
+      // which means waiting for the tasks that use them (see set_lazy)
+      auto sort = [this](auto &component) {
+        if (component.sorted)
+          return;
+        pool.wait_for(component.waiting());
+        component.clear_waiting();
+        component.ensure_sorted();
+      };
+      (sort(c), ...);
+    }
+
+    struct Call {
+      // held by an apply while it schedules, and counts it (see stats)
+      template <typename F>
+      Call(Manager &manager_, F f)
+        : manager(manager_), lock(manager_.scheduling) {
+        auto site = next_site;
+        next_site = {};
+        if (!manager.collect_stats)
+          return;
+        site.function = reinterpret_cast<void (*)()>(f);
+        counters = &manager.counters[site];
+        if (manager.current_system) {
+          counters->name = *manager.current_system;
+        }
+        ++counters->calls;
+        previous = manager.call;
+        manager.call = counters;
+        start = std::chrono::steady_clock::now();
+      }
+
+      ~Call() {
+        if (!counters)
+          return;
+        counters->schedule += std::chrono::nanoseconds(
+            std::chrono::steady_clock::now() - start).count();
+        manager.call = previous;
+      }
+
+      Manager &manager;
+      std::scoped_lock<std::recursive_mutex> lock;
+      Counters *counters {nullptr};
+      Counters *previous {nullptr};
+      std::chrono::steady_clock::time_point start;
+    };
+
+    template <typename F>
+    int push_task(const F &task, std::vector<int> wait) {
+      // push a task of the apply that is scheduling, and time it
+      if (!call)
+        return pool.push_task(task, std::move(wait));
+      ++call->blocks;
+      return pool.push_task([task, counters = call,
+                             pushed = std::chrono::steady_clock::now()]() {
+        auto start = std::chrono::steady_clock::now();
+        matches = 0;
+        visits = 0;
+        task();
+        auto end = std::chrono::steady_clock::now();
+        counters->matched += matches;
+        counters->visited += visits;
+        counters->execute += std::chrono::nanoseconds(end - start).count();
+        counters->queued += std::chrono::nanoseconds(start - pushed).count();
+      }, std::move(wait));
+    }
+
+    template <typename F>
+    int push_task(const F &task, int wait) {
+      return push_task(task, std::vector<int> {wait});
+    }
+
+    std::vector<std::pair<std::string, MemoryStats>> memory() {
+      // per enlisted component (by name), and then the pool, as "pool"
+      std::vector<std::pair<std::string, MemoryStats>> result;
+      for (size_t i = 0; i < components.size(); ++i) {
+        result.emplace_back(component_names[i], components[i]->memory());
+      }
+      result.emplace_back("pool", pool.memory());
+      return result;
+    }
+
+    void debug_print_memory() {
+      MemoryStats total;
+      for (auto &[name, stats]: memory()) {
+        std::cout << name << " : " << stats.size << '/' << stats.capacity
+                  << ' ' << stats.bytes << "B (" << stats.create_high_water
+                  << ' ' << stats.destroy_high_water << ')' << std::endl;
+        total += stats;
+      }
+      std::cout << "total : " << total.bytes << 'B' << std::endl;
+    }
+
+    void debug_print_schedule() {
+      auto &s = schedule();
+      for (size_t i = 0; i < s.size(); ++i) {
+        std::cout << i << " : ";
+        for (auto j: s[i]) {
+          std::cout << systems[j].name << ' ';
+        }
+        std::cout << std::endl;
       }
     }
 
@@ -486,6 +3149,7 @@ namespace ecs {
      */
 
     template <typename A> void apply(Component<A> &a, void (*f)(A &)) {
+      Call call(*this, f);
       if (a.data.size() == 0)
         return; // no work to do
 
@@ -493,14 +3157,16 @@ namespace ecs {
       while (static_cast<size_t>(i) < a.data.size()) {
         int j = std::min(a.data.size(), static_cast<size_t>(i + BLOCK_SIZE));
         auto wait = a.waiting_flags.get(i, j);
-        auto flag = pool.push_task([f,
+        auto flag = push_task([f,
                                   first = a.data.begin() + i,
                                   last = a.data.begin() + j]() {
           auto it = first;
           while (it != last) {
+            ++matches;
             f(it->second);
             ++it;
           }
+          visits += last - first;
         }, wait);
         a.waiting_flags.set(i, j, flag);
         i += BLOCK_SIZE;
@@ -512,6 +3178,7 @@ namespace ecs {
       // a version that passes along an arbitrary void pointer
       // could be used to access some shared data (in an unprotected manner)
       // since the may be accessed in parallel, it is probably unwise to modify it
+      Call call(*this, f);
       if (a.data.size() == 0)
         return; // no work to do
 
@@ -519,14 +3186,16 @@ namespace ecs {
       while (static_cast<size_t>(i) < a.data.size()) {
         int j = std::min(a.data.size(), static_cast<size_t>(i + BLOCK_SIZE));
         auto wait = a.waiting_flags.get(i, j);
-        auto flag = pool.push_task([f, payload,
+        auto flag = push_task([f, payload,
                                     first = a.data.begin() +
                                     i, last = a.data.begin() + j]() {
               auto it = first;
               while (it != last) {
+                ++matches;
                 f(it->second, payload);
                 ++it;
               }
+              visits += last - first;
             },
             wait);
         a.waiting_flags.set(i, j, flag);
@@ -536,6 +3205,8 @@ namespace ecs {
 
     template <typename A, typename B>
     void apply(Component<A> &a, Component<B> &b, void (*f)(A &, B &)) {
+      Call call(*this, f);
+      sort_lazy(a, b);
       if ((a.data.size() == 0) || (b.data.size() == 0))
         return;
 
@@ -566,27 +3237,38 @@ namespace ecs {
                                return a.first < b;
                              });
 
+        if (!overlap(std::make_pair(it_a, it_a_break),
+                     std::make_pair(it_b, it_b_break))) {
+          // no id can be in all of them, so there's nothing to do
+          it_a = it_a_break;
+          it_b = it_b_break;
+          continue;
+        }
+
         auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                           it_a_break - a.data.begin());
         auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
                                           it_b_break - b.data.begin());
         wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-        auto flag = pool.push_task(
+        auto flag = push_task(
             [f,
              afirst = it_a, alast = it_a_break,
-             bfirst = it_b, blast = it_b_break]() {
+             bfirst = it_b, blast = it_b_break,
+             za = &a.zones, zb = &b.zones]() {
               auto it_a = afirst;
               auto it_b = bfirst;
               while ((it_a != alast) && (it_b != blast)) {
                 if (it_a->first == it_b->first) {
+                  ++matches;
+                  visits += 2;
                   f(it_a->second, it_b->second);
                   ++it_a;
                   ++it_b;
                 } else if (it_a->first < it_b->first) {
-                  ++it_a;
+                  it_a = za->seek(it_a, alast, it_b->first);
                 } else {
-                  ++it_b;
+                  it_b = zb->seek(it_b, blast, it_a->first);
                 }
               }
             }, wait_a);
@@ -602,25 +3284,32 @@ namespace ecs {
         it_b = it_b_break;
       }
 
+      if (!overlap(std::make_pair(it_a, a.data.end()),
+                   std::make_pair(it_b, b.data.end())))
+        return;
+
       auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                         a.data.size());
       auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
                                         b.data.size());
       wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-      auto flag = pool.push_task([f, afirst = it_a, alast = a.data.end(),
-                                bfirst = it_b, blast = b.data.end()]() {
+      auto flag = push_task([f, afirst = it_a, alast = a.data.end(),
+                                bfirst = it_b, blast = b.data.end(),
+                                za = &a.zones, zb = &b.zones]() {
         auto it_a = afirst;
         auto it_b = bfirst;
         while ((it_a != alast) && (it_b != blast)) {
           if (it_a->first == it_b->first) {
+            ++matches;
+            visits += 2;
             f(it_a->second, it_b->second);
             ++it_a;
             ++it_b;
           } else if (it_a->first < it_b->first) {
-            ++it_a;
+            it_a = za->seek(it_a, alast, it_b->first);
           } else {
-            ++it_b;
+            it_b = zb->seek(it_b, blast, it_a->first);
           }
         }
       }, wait_a);
@@ -636,6 +3325,8 @@ namespace ecs {
     template <typename A, typename B>
     void apply(Component<A> &a, Component<B> &b, void (*f)(A &, B &, void *),
                void *payload) {
+      Call call(*this, f);
+      sort_lazy(a, b);
       if ((a.data.size() == 0) || (b.data.size() == 0))
         return;
 
@@ -666,27 +3357,38 @@ namespace ecs {
                                return a.first < b;
                              });
 
+        if (!overlap(std::make_pair(it_a, it_a_break),
+                     std::make_pair(it_b, it_b_break))) {
+          // no id can be in all of them, so there's nothing to do
+          it_a = it_a_break;
+          it_b = it_b_break;
+          continue;
+        }
+
         auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                           it_a_break - a.data.begin());
         auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
                                           it_b_break - b.data.begin());
         wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-        auto flag = pool.push_task(
+        auto flag = push_task(
                                    [f, payload,
              afirst = it_a, alast = it_a_break,
-             bfirst = it_b, blast = it_b_break]() {
+             bfirst = it_b, blast = it_b_break,
+             za = &a.zones, zb = &b.zones]() {
               auto it_a = afirst;
               auto it_b = bfirst;
               while ((it_a != alast) && (it_b != blast)) {
                 if (it_a->first == it_b->first) {
+                  ++matches;
+                  visits += 2;
                   f(it_a->second, it_b->second, payload);
                   ++it_a;
                   ++it_b;
                 } else if (it_a->first < it_b->first) {
-                  ++it_a;
+                  it_a = za->seek(it_a, alast, it_b->first);
                 } else {
-                  ++it_b;
+                  it_b = zb->seek(it_b, blast, it_a->first);
                 }
               }
             }, wait_a);
@@ -702,26 +3404,33 @@ namespace ecs {
         it_b = it_b_break;
       }
 
+      if (!overlap(std::make_pair(it_a, a.data.end()),
+                   std::make_pair(it_b, b.data.end())))
+        return;
+
       auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                         a.data.size());
       auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
                                         b.data.size());
       wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-      auto flag = pool.push_task([f, payload,
+      auto flag = push_task([f, payload,
                                   afirst = it_a, alast = a.data.end(),
-                                  bfirst = it_b, blast = b.data.end()]() {
+                                  bfirst = it_b, blast = b.data.end(),
+                                  za = &a.zones, zb = &b.zones]() {
         auto it_a = afirst;
         auto it_b = bfirst;
         while ((it_a != alast) && (it_b != blast)) {
           if (it_a->first == it_b->first) {
+            ++matches;
+            visits += 2;
             f(it_a->second, it_b->second, payload);
             ++it_a;
             ++it_b;
           } else if (it_a->first < it_b->first) {
-            ++it_a;
+            it_a = za->seek(it_a, alast, it_b->first);
           } else {
-            ++it_b;
+            it_b = zb->seek(it_b, blast, it_a->first);
           }
         }
       }, wait_a);
@@ -737,6 +3446,8 @@ namespace ecs {
     template <typename A, typename B, typename C>
     void apply(Component<A> &a, Component<B> &b,
                Component<C> &c, void (*f)(A &, B &, C &)) {
+      Call call(*this, f);
+      sort_lazy(a, b, c);
       if ((a.data.size() == 0) || (b.data.size() == 0) || (c.data.size() == 0))
         return;
 
@@ -776,6 +3487,16 @@ namespace ecs {
                                return a.first < b;
                              });
 
+        if (!overlap(std::make_pair(it_a, it_a_break),
+                     std::make_pair(it_b, it_b_break),
+                     std::make_pair(it_c, it_c_break))) {
+          // no id can be in all of them, so there's nothing to do
+          it_a = it_a_break;
+          it_b = it_b_break;
+          it_c = it_c_break;
+          continue;
+        }
+
         auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                           it_a_break - a.data.begin());
         auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
@@ -787,29 +3508,207 @@ namespace ecs {
 
         // the idea here is to increment whichever iterator points to the lowest id
         // and if they're all equal, then we apply the function, and increase all
-        auto flag = pool.push_task(
+        auto flag = push_task(
             [f,
              afirst = it_a, alast = it_a_break,
              bfirst = it_b, blast = it_b_break,
-             cfirst = it_c, clast = it_c_break]() {
+             cfirst = it_c, clast = it_c_break,
+             za = &a.zones, zb = &b.zones, zc = &c.zones]() {
               auto it_a = afirst;
               auto it_b = bfirst;
               auto it_c = cfirst;
               while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
                 if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
+                  ++matches;
+                  visits += 3;
                   f(it_a->second, it_b->second, it_c->second);
                   ++it_a;
                   ++it_b;
                   ++it_c;
                 } else if ((it_a->first < it_b->first) ||
                            (it_a->first < it_c->first)) {
-                  ++it_a;
+                  it_a = za->seek(it_a, alast,
+                                  std::max(it_b->first, it_c->first));
                 } else if ((it_b->first < it_a->first) ||
                            (it_b->first < it_c->first)) {
+                  it_b = zb->seek(it_b, blast,
+                                  std::max(it_a->first, it_c->first));
+                } else if ((it_c->first < it_a->first) ||
+                           (it_c->first < it_b->first)) {
+                  it_c = zc->seek(it_c, clast,
+                                  std::max(it_a->first, it_b->first));
+                }
+              }
+            }, wait_a);
+
+        a.waiting_flags.set(it_a - a.data.begin(),
+                            it_a_break - a.data.begin(),
+                            flag);
+        b.waiting_flags.set(it_b - b.data.begin(),
+                            it_b_break - b.data.begin(),
+                            flag);
+        c.waiting_flags.set(it_c - c.data.begin(),
+                            it_c_break - c.data.begin(),
+                            flag);
+
+        it_a = it_a_break;
+        it_b = it_b_break;
+        it_c = it_c_break;
+      }
+
+      if (!overlap(std::make_pair(it_a, a.data.end()),
+                   std::make_pair(it_b, b.data.end()),
+                   std::make_pair(it_c, c.data.end())))
+        return;
+
+      auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
+                                        a.data.size());
+      auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
+                                        b.data.size());
+      auto wait_c = c.waiting_flags.get(it_c - c.data.begin(),
+                                        c.data.size());
+
+      wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
+      wait_a.insert(wait_a.end(), wait_c.begin(), wait_c.end());
+
+      auto flag = push_task(
+          [f,
+           afirst = it_a, alast = a.data.end(),
+           bfirst = it_b, blast = b.data.end(),
+           cfirst = it_c, clast = c.data.end(),
+           za = &a.zones, zb = &b.zones, zc = &c.zones]() {
+            auto it_a = afirst;
+            auto it_b = bfirst;
+            auto it_c = cfirst;
+            while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
+              if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
+                ++matches;
+                visits += 3;
+                f(it_a->second, it_b->second, it_c->second);
+                ++it_a;
+                ++it_b;
+                ++it_c;
+              } else if ((it_a->first < it_b->first) ||
+                          (it_a->first < it_c->first)) {
+                it_a = za->seek(it_a, alast,
+                                std::max(it_b->first, it_c->first));
+              } else if ((it_b->first < it_a->first) ||
+                          (it_b->first < it_c->first)) {
+                it_b = zb->seek(it_b, blast,
+                                std::max(it_a->first, it_c->first));
+              } else if ((it_c->first < it_a->first) ||
+                          (it_c->first < it_b->first)) {
+                it_c = zc->seek(it_c, clast,
+                                std::max(it_a->first, it_b->first));
+              }
+            }
+          }, wait_a);
+
+      a.waiting_flags.set(it_a - a.data.begin(),
+                          a.data.size(),
+                          flag);
+      b.waiting_flags.set(it_b - b.data.begin(),
+                          b.data.size(),
+                          flag);
+      c.waiting_flags.set(it_c - c.data.begin(),
+                          c.data.size(),
+                          flag);
+    }
+
+    template <typename A, typename B, typename C>
+    void apply(Component<A> &a, Component<B> &b, Component<C> &c,
+               void (*f)(A &, B &, C &, void *), void *payload) {
+      Call call(*this, f);
+      sort_lazy(a, b, c);
+      if ((a.data.size() == 0) || (b.data.size() == 0) || (c.data.size() == 0))
+        return;
+
+      int n = (a.data.size() + b.data.size() + c.data.size())/BLOCK_SIZE/3;
+      n = std::max(n, 1);
+      int a_step = a.data.size()/n;
+      int b_step = b.data.size()/n;
+      int c_step = c.data.size()/n;
+
+      std::vector<int> breaks;
+      breaks.reserve(n);
+      for (int i = 1; i < n; ++i) {
+        breaks.push_back((a.data[i*a_step].first +
+                          b.data[i*b_step].first +
+                          c.data[i*c_step].first) / 3);
+      }
+
+      auto it_a = a.data.begin();
+      auto it_b = b.data.begin();
+      auto it_c = c.data.begin();
+
+      for (auto breakpoint: breaks) {
+        // find an iterator to the entity with id = breakpoint in each list
+        auto it_a_break =
+            std::lower_bound(a.data.begin(), a.data.end(), breakpoint,
+                             [](const std::pair<uint32_t, A> &a, uint32_t b) {
+                               return a.first < b;
+                             });
+        auto it_b_break =
+            std::lower_bound(b.data.begin(), b.data.end(), breakpoint,
+                             [](const std::pair<uint32_t, B> &a, uint32_t b) {
+                               return a.first < b;
+                             });
+        auto it_c_break =
+            std::lower_bound(c.data.begin(), c.data.end(), breakpoint,
+                             [](const std::pair<uint32_t, C> &a, uint32_t b) {
+                               return a.first < b;
+                             });
+
+        if (!overlap(std::make_pair(it_a, it_a_break),
+                     std::make_pair(it_b, it_b_break),
+                     std::make_pair(it_c, it_c_break))) {
+          // no id can be in all of them, so there's nothing to do
+          it_a = it_a_break;
+          it_b = it_b_break;
+          it_c = it_c_break;
+          continue;
+        }
+
+        auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
+                                          it_a_break - a.data.begin());
+        auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
+                                          it_b_break - b.data.begin());
+        auto wait_c = c.waiting_flags.get(it_c - c.data.begin(),
+                                          it_c_break - c.data.begin());
+        wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
+        wait_a.insert(wait_a.end(), wait_c.begin(), wait_c.end());
+
+        // the idea here is to increment whichever iterator points to the lowest id
+        // and if they're all equal, then we apply the function, and increase all
+        auto flag = push_task(
+                                   [f, payload,
+             afirst = it_a, alast = it_a_break,
+             bfirst = it_b, blast = it_b_break,
+             cfirst = it_c, clast = it_c_break,
+             za = &a.zones, zb = &b.zones, zc = &c.zones]() {
+              auto it_a = afirst;
+              auto it_b = bfirst;
+              auto it_c = cfirst;
+              while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
+                if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
+                  ++matches;
+                  visits += 3;
+                  f(it_a->second, it_b->second, it_c->second, payload);
+                  ++it_a;
                   ++it_b;
+                  ++it_c;
+                } else if ((it_a->first < it_b->first) ||
+                           (it_a->first < it_c->first)) {
+                  it_a = za->seek(it_a, alast,
+                                  std::max(it_b->first, it_c->first));
+                } else if ((it_b->first < it_a->first) ||
+                           (it_b->first < it_c->first)) {
+                  it_b = zb->seek(it_b, blast,
+                                  std::max(it_a->first, it_c->first));
                 } else if ((it_c->first < it_a->first) ||
                            (it_c->first < it_b->first)) {
-                  ++it_c;
+                  it_c = zc->seek(it_c, clast,
+                                  std::max(it_a->first, it_b->first));
                 }
               }
             }, wait_a);
@@ -829,6 +3728,11 @@ namespace ecs {
         it_c = it_c_break;
       }
 
+      if (!overlap(std::make_pair(it_a, a.data.end()),
+                   std::make_pair(it_b, b.data.end()),
+                   std::make_pair(it_c, c.data.end())))
+        return;
+
       auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                         a.data.size());
       auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
@@ -839,29 +3743,35 @@ namespace ecs {
       wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
       wait_a.insert(wait_a.end(), wait_c.begin(), wait_c.end());
 
-      auto flag = pool.push_task(
-          [f,
+      auto flag = push_task(
+                                 [f, payload,
            afirst = it_a, alast = a.data.end(),
            bfirst = it_b, blast = b.data.end(),
-           cfirst = it_c, clast = c.data.end()]() {
+           cfirst = it_c, clast = c.data.end(),
+           za = &a.zones, zb = &b.zones, zc = &c.zones]() {
             auto it_a = afirst;
             auto it_b = bfirst;
             auto it_c = cfirst;
             while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
               if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
-                f(it_a->second, it_b->second, it_c->second);
+                ++matches;
+                visits += 3;
+                f(it_a->second, it_b->second, it_c->second, payload);
                 ++it_a;
                 ++it_b;
                 ++it_c;
               } else if ((it_a->first < it_b->first) ||
                           (it_a->first < it_c->first)) {
-                ++it_a;
+                it_a = za->seek(it_a, alast,
+                                std::max(it_b->first, it_c->first));
               } else if ((it_b->first < it_a->first) ||
                           (it_b->first < it_c->first)) {
-                ++it_b;
+                it_b = zb->seek(it_b, blast,
+                                std::max(it_a->first, it_c->first));
               } else if ((it_c->first < it_a->first) ||
                           (it_c->first < it_b->first)) {
-                ++it_c;
+                it_c = zc->seek(it_c, clast,
+                                std::max(it_a->first, it_b->first));
               }
             }
           }, wait_a);
@@ -877,29 +3787,29 @@ namespace ecs {
                           flag);
     }
 
-    template <typename A, typename B, typename C>
-    void apply(Component<A> &a, Component<B> &b, Component<C> &c,
-               void (*f)(A &, B &, C &, void *), void *payload) {
-      if ((a.data.size() == 0) || (b.data.size() == 0) || (c.data.size() == 0))
+    // below are versions of apply that exclude some components
+
+    template <typename A, typename B>
+    void apply(Component<A> &a, void (*f)(A &, B &, void *), void *payload,
+               Component<B> &b) {
+      Call call(*this, f);
+      sort_lazy(a, b);
+      if ((a.data.size() == 0) || (b.data.size() == 0))
         return;
 
-      int n = (a.data.size() + b.data.size() + c.data.size())/BLOCK_SIZE/3;
+      int n = (a.data.size() + b.data.size())/BLOCK_SIZE/2;
       n = std::max(n, 1);
       int a_step = a.data.size()/n;
       int b_step = b.data.size()/n;
-      int c_step = c.data.size()/n;
 
       std::vector<int> breaks;
       breaks.reserve(n);
       for (int i = 1; i < n; ++i) {
-        breaks.push_back((a.data[i*a_step].first +
-                          b.data[i*b_step].first +
-                          c.data[i*c_step].first) / 3);
+        breaks.push_back((a.data[i*a_step].first + b.data[i*b_step].first) / 2);
       }
 
       auto it_a = a.data.begin();
       auto it_b = b.data.begin();
-      auto it_c = c.data.begin();
 
       for (auto breakpoint: breaks) {
         // find an iterator to the entity with id = breakpoint in each list
@@ -913,48 +3823,32 @@ namespace ecs {
                              [](const std::pair<uint32_t, B> &a, uint32_t b) {
                                return a.first < b;
                              });
-        auto it_c_break =
-            std::lower_bound(c.data.begin(), c.data.end(), breakpoint,
-                             [](const std::pair<uint32_t, C> &a, uint32_t b) {
-                               return a.first < b;
-                             });
 
         auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                           it_a_break - a.data.begin());
         auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
                                           it_b_break - b.data.begin());
-        auto wait_c = c.waiting_flags.get(it_c - c.data.begin(),
-                                          it_c_break - c.data.begin());
         wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
-        wait_a.insert(wait_a.end(), wait_c.begin(), wait_c.end());
 
-        // the idea here is to increment whichever iterator points to the lowest id
-        // and if they're all equal, then we apply the function, and increase all
-        auto flag = pool.push_task(
+        auto flag = push_task(
                                    [f, payload,
              afirst = it_a, alast = it_a_break,
-             bfirst = it_b, blast = it_b_break,
-             cfirst = it_c, clast = it_c_break]() {
+             bfirst = it_b, blast = it_b_break]() {
               auto it_a = afirst;
               auto it_b = bfirst;
-              auto it_c = cfirst;
-              while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
-                if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
-                  f(it_a->second, it_b->second, it_c->second, payload);
+              while ((it_a != alast) && (it_b != blast)) {
+                if (it_a->first == it_b->first) {
                   ++it_a;
                   ++it_b;
-                  ++it_c;
-                } else if ((it_a->first < it_b->first) ||
-                           (it_a->first < it_c->first)) {
+                } else if (it_a->first < it_b->first) {
+                  ++matches;
+                  f(it_a->second, payload);
                   ++it_a;
-                } else if ((it_b->first < it_a->first) ||
-                           (it_b->first < it_c->first)) {
+                } else {
                   ++it_b;
-                } else if ((it_c->first < it_a->first) ||
-                           (it_c->first < it_b->first)) {
-                  ++it_c;
                 }
               }
+              visits += (it_a - afirst) + (it_b - bfirst);
             }, wait_a);
 
         a.waiting_flags.set(it_a - a.data.begin(),
@@ -963,69 +3857,779 @@ namespace ecs {
         b.waiting_flags.set(it_b - b.data.begin(),
                             it_b_break - b.data.begin(),
                             flag);
-        c.waiting_flags.set(it_c - c.data.begin(),
-                            it_c_break - c.data.begin(),
-                            flag);
 
         it_a = it_a_break;
         it_b = it_b_break;
-        it_c = it_c_break;
       }
 
-      auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
-                                        a.data.size());
-      auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
-                                        b.data.size());
-      auto wait_c = c.waiting_flags.get(it_c - c.data.begin(),
-                                        c.data.size());
-
-      wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
-      wait_a.insert(wait_a.end(), wait_c.begin(), wait_c.end());
+      auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
+                                        a.data.size());
+      auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
+                                        b.data.size());
+      wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
+
+      auto flag = push_task([f, payload,
+                                  afirst = it_a, alast = a.data.end(),
+                                  bfirst = it_b, blast = b.data.end()]() {
+        auto it_a = afirst;
+        auto it_b = bfirst;
+        while ((it_a != alast) && (it_b != blast)) {
+          if (it_a->first == it_b->first) {
+            ++it_a;
+            ++it_b;
+          } else if (it_a->first < it_b->first) {
+            ++matches;
+            f(it_a->second, payload);
+            ++it_a;
+          } else {
+            ++it_b;
+          }
+        }
+        visits += (it_a - afirst) + (it_b - bfirst);
+      }, wait_a);
+
+      a.waiting_flags.set(it_a - a.data.begin(),
+                          a.data.size(),
+                          flag);
+      b.waiting_flags.set(it_b - b.data.begin(),
+                          b.data.size(),
+                          flag);
+    }
+
+    template <typename... T>
+    void apply(Query<T...> &q, void (*f)(T &...)) {
+      // applies f to all matches of the query
+      // which is only rebuilt if one of the components changed since last time
+      Call call(*this, f);
+      std::apply([this](auto &... c) { sort_lazy(c...); }, q.components);
+      if (q.stale())
+        q.build();
+      if (q.matches.size() == 0)
+        return; // no work to do
+
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        size_t i = 0;
+        while (i < q.matches.size()) {
+          size_t j = std::min(q.matches.size(), i + BLOCK_SIZE);
+          auto &first = q.matches[i];
+          auto &last = q.matches[j - 1];
+
+          std::vector<int> wait;
+          auto add_wait = [&wait](std::vector<int> w) {
+            wait.insert(wait.end(), w.begin(), w.end());
+          };
+          (add_wait(std::get<I>(q.components).waiting_flags.get(
+              first[I], last[I] + 1)), ...);
+
+          auto flag = push_task([f,
+                                      mfirst = q.matches.data() + i,
+                                      mlast = q.matches.data() + j,
+                                      data = std::make_tuple(
+                                          std::get<I>(q.components).data.data()...)
+                                     ]() {
+            for (auto m = mfirst; m != mlast; ++m) {
+              ++matches;
+              f(std::get<I>(data)[(*m)[I]].second...);
+            }
+            visits += mlast - mfirst;
+          }, wait);
+
+          (std::get<I>(q.components).waiting_flags.set(
+              first[I], last[I] + 1, flag), ...);
+          i = j;
+        }
+      }(std::index_sequence_for<T...>{});
+    }
+
+    /*
+     * below are versions of apply that take optional components
+     * like apply(a, ecs::optional(b), &foo)
+     * which runs foo(A &a, B *b) for all entities that have an a
+     * where b is nullptr for the entities that don't have a b.
+     * Any number of components can also be excluded, by passing them after
+     * the function, like apply(a, &foo, b, c) for the entities that have
+     * an a but neither a b nor a c (this is also how a single one is excluded).
+     * These are all driven by the first component, so all the other components
+     * are resolved in the same pass, and none of them are scanned twice
+     */
+
+    template <typename A, typename... X>
+    void apply(Component<A> &a, void (*f)(A &), Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (!(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second);
+          }
+        }
+      }, excluded...);
+    }
+
+    template <typename A, typename B, typename... X>
+    void apply(Component<A> &a, Component<B> &b, void (*f)(A &, B &),
+               Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, b, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto rb, auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first) && !(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second, rb.first->second);
+          }
+        }
+      }, b, excluded...);
+    }
+
+    template <typename A, typename B, typename C, typename... X>
+    void apply(Component<A> &a, Component<B> &b, Component<C> &c,
+               void (*f)(A &, B &, C &), Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, b, c, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto rb, auto rc,
+                          auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first) && seek(rc, it_a->first) &&
+              !(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second, rb.first->second, rc.first->second);
+          }
+        }
+      }, b, c, excluded...);
+    }
+
+    template <typename A, typename B, typename... X>
+    void apply(Component<A> &a, Optional<B> b, void (*f)(A &, B *),
+               Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, b.component, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto rb, auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (!(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second,
+              seek(rb, it_a->first) ? &rb.first->second : nullptr);
+          }
+        }
+      }, b.component, excluded...);
+    }
+
+    template <typename A, typename B, typename C, typename... X>
+    void apply(Component<A> &a, Optional<B> b, Optional<C> c,
+               void (*f)(A &, B *, C *), Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, b.component, c.component, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto rb, auto rc,
+                          auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (!(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second,
+              seek(rb, it_a->first) ? &rb.first->second : nullptr,
+              seek(rc, it_a->first) ? &rc.first->second : nullptr);
+          }
+        }
+      }, b.component, c.component, excluded...);
+    }
+
+    template <typename A, typename B, typename C, typename... X>
+    void apply(Component<A> &a, Component<B> &b, Optional<C> c,
+               void (*f)(A &, B &, C *), Component<X> &... excluded) {
+      Call call(*this, f);
+      sort_lazy(a, b, c.component, excluded...);
+      apply_driven(a, [f](auto afirst, auto alast, auto rb, auto rc,
+                          auto... rx) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first) && !(seek(rx, it_a->first) || ...)) {
+            ++matches;
+            f(it_a->second, rb.first->second,
+              seek(rc, it_a->first) ? &rc.first->second : nullptr);
+          }
+        }
+      }, b, c.component, excluded...);
+    }
+
+    /*
+     * Event channels are written by passing the channel to apply
+     * like apply(a, &foo, channel), which runs foo(A &a, EventChannel<E> &)
+     * and foo can then send to the channel (from any number of systems).
+     * Then apply(channel, &bar) runs bar(E &event) on all events sent so far,
+     * in parallel, after the systems that send have finished.
+     */
+
+    template <typename A, typename E>
+    void apply(Component<A> &a, void (*f)(A &, EventChannel<E> &),
+               EventChannel<E> &channel) {
+      Call call(*this, f);
+      auto flags = apply_driven(a, [f, &channel](auto afirst, auto alast) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          ++matches;
+          f(it_a->second, channel);
+        }
+      });
+      channel.producers.insert(channel.producers.end(),
+                               flags.begin(), flags.end());
+    }
+
+    template <typename A, typename B, typename E>
+    void apply(Component<A> &a, Component<B> &b,
+               void (*f)(A &, B &, EventChannel<E> &),
+               EventChannel<E> &channel) {
+      Call call(*this, f);
+      sort_lazy(a, b);
+      auto flags = apply_driven(a, [f, &channel](auto afirst, auto alast,
+                                                 auto rb) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first)) {
+            ++matches;
+            f(it_a->second, rb.first->second, channel);
+          }
+        }
+      }, b);
+      channel.producers.insert(channel.producers.end(),
+                               flags.begin(), flags.end());
+    }
+
+    template <typename E>
+    void apply(EventChannel<E> &channel, void (*f)(E &)) {
+      // the number of events isn't known until they've been gathered
+      // so the work is split evenly over a task per worker thread
+      // and the gathering waits for both producers and earlier consumers
+      // (since it may reallocate the events they're reading)
+      Call call(*this, f);
+      auto gather = push_task([&channel]() { channel.gather(); },
+                                   channel.waiting());
+      int n_tasks = std::max(pool.size(), 1);
+      for (int k = 0; k < n_tasks; ++k) {
+        channel.consumers.push_back(push_task([f, &channel, k, n_tasks]() {
+          size_t n = channel.events.size();
+          for (size_t i = n*k/n_tasks; i < n*(k + 1)/n_tasks; ++i) {
+            ++matches;
+            ++visits;
+            f(channel.events[i]);
+          }
+        }, gather));
+      }
+    }
+
+    /*
+     * Resources are passed to apply after the function
+     * like apply(a, &foo, ecs::read(r)) which runs foo(A &a, const T &r)
+     * or apply(a, &foo, ecs::write(r)) which runs foo(A &a, T &r)
+     * A read waits for the last write, and a write waits for everything.
+     */
+
+    template <typename A, typename T>
+    void apply(Component<A> &a, void (*f)(A &, const T &), Read<T> r) {
+      Call call(*this, f);
+      auto &value = r.resource.value;
+      auto flags = apply_driven(a, [f, &value](auto afirst, auto alast) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          ++matches;
+          f(it_a->second, value);
+        }
+      }, r.resource.writers, false, std::index_sequence<>{});
+      read_by(r.resource, flags);
+    }
+
+    template <typename A, typename T>
+    void apply(Component<A> &a, void (*f)(A &, T &), Write<T> w) {
+      Call call(*this, f);
+      auto &value = w.resource.value;
+      auto flags = apply_driven(a, [f, &value](auto afirst, auto alast) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          ++matches;
+          f(it_a->second, value);
+        }
+      }, w.resource.waiting(), true, std::index_sequence<>{});
+      written_by(w.resource, flags);
+    }
+
+    template <typename A, typename B, typename T>
+    void apply(Component<A> &a, Component<B> &b,
+               void (*f)(A &, B &, const T &), Read<T> r) {
+      Call call(*this, f);
+      sort_lazy(a, b);
+      auto &value = r.resource.value;
+      auto flags = apply_driven(a, [f, &value](auto afirst, auto alast,
+                                               auto rb) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first)) {
+            ++matches;
+            f(it_a->second, rb.first->second, value);
+          }
+        }
+      }, r.resource.writers, false, std::index_sequence<0>{}, b);
+      read_by(r.resource, flags);
+    }
+
+    template <typename A, typename B, typename T>
+    void apply(Component<A> &a, Component<B> &b,
+               void (*f)(A &, B &, T &), Write<T> w) {
+      Call call(*this, f);
+      sort_lazy(a, b);
+      auto &value = w.resource.value;
+      auto flags = apply_driven(a, [f, &value](auto afirst, auto alast,
+                                               auto rb) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first)) {
+            ++matches;
+            f(it_a->second, rb.first->second, value);
+          }
+        }
+      }, w.resource.waiting(), true, std::index_sequence<0>{}, b);
+      written_by(w.resource, flags);
+    }
+
+    /*
+     * Read only components (the front of a DoubleBuffered) are passed
+     * like any other, as in apply(a.front(), b.front(), c, &foo)
+     * which runs foo(const A &a, const B &b, C &c).
+     */
+
+    template <typename A, typename B>
+    void apply(ReadOnly<A> a, Component<B> &b, void (*f)(const A &, B &)) {
+      Call call(*this, f);
+      sort_lazy(a.component, b);
+      apply_driven(a.component, [f](auto afirst, auto alast, auto rb) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first)) {
+            ++matches;
+            f(it_a->second, rb.first->second);
+          }
+        }
+      }, b);
+    }
+
+    template <typename A, typename B, typename C>
+    void apply(ReadOnly<A> a, ReadOnly<B> b, Component<C> &c,
+               void (*f)(const A &, const B &, C &)) {
+      Call call(*this, f);
+      sort_lazy(a.component, b.component, c);
+      apply_driven(a.component, [f](auto afirst, auto alast, auto rb, auto rc) {
+        for (auto it_a = afirst; it_a != alast; ++it_a) {
+          if (seek(rb, it_a->first) && seek(rc, it_a->first)) {
+            ++matches;
+            f(it_a->second, rb.first->second, rc.first->second);
+          }
+        }
+      }, b.component, c);
+    }
+
+    template <typename T>
+    void read_by(Resource<T> &resource, const std::vector<int> &flags) {
+      pool.forget_done(resource.readers);
+      resource.readers.insert(resource.readers.end(),
+                              flags.begin(), flags.end());
+    }
+
+    template <typename T>
+    void written_by(Resource<T> &resource, const std::vector<int> &flags) {
+      // the blocks are chained, so the last one is done after all the others
+      if (flags.empty())
+        return;
+      resource.writers = {flags.back()};
+      resource.readers.clear();
+    }
+
+    template <typename T>
+    using BlockRange =
+        std::pair<typename std::vector<std::pair<uint32_t, T>>::iterator,
+                  typename std::vector<std::pair<uint32_t, T>>::iterator>;
+
+    template <typename A, typename K, typename... O>
+    std::vector<int> apply_driven(Component<A> &a, K kernel,
+                                  Component<O> &... others) {
+      return apply_driven(a, kernel, {}, false,
+                          std::index_sequence_for<O...>{}, others...);
+    }
+
+    template <typename A, typename K, size_t... I, typename... O>
+    std::vector<int> apply_driven(Component<A> &a, K kernel,
+                                  std::vector<int> after, bool chained,
+                                  std::index_sequence<I...>,
+                                  Component<O> &... others) {
+
+      /*
+       * Splits a into blocks, and finds the range of each other component
+       * that covers the same entity ids as the block. Then pushes a task
+       * that runs kernel(a_first, a_last, std::make_pair(o_first, o_last)...)
+       * for every block. Returns the tasks.
+       * Every block also waits for the tasks in after, and if chained,
+       * every block waits for the one before it (e.g. to write a resource).
+       */
+
+      std::vector<int> flags;
+      if (a.data.size() == 0)
+        return flags; // no work to do
+
+      std::array<size_t, sizeof...(O)> cursors {};
+      size_t i = 0;
+      while (i < a.data.size()) {
+        size_t j = std::min(a.data.size(), i + BLOCK_SIZE);
+        auto wait = a.waiting_flags.get(i, j);
+
+        wait.insert(wait.end(), after.begin(), after.end());
+
+        [[maybe_unused]] auto starts = cursors;
+        std::tuple<BlockRange<O>...> ranges {
+          block_range(others, cursors[I], a, j, wait)...
+        };
+
+        auto flag = push_task([kernel, ranges,
+                                    first = a.data.begin() + i,
+                                    last = a.data.begin() + j]() {
+          std::apply([&](auto... range) {
+            kernel(first, last, range...);
+          }, ranges);
+          // the kernels step through all of a, and seek through the others
+          visits += last - first;
+        }, wait);
+
+        a.waiting_flags.set(i, j, flag);
+        ((starts[I] < cursors[I] ?
+          others.waiting_flags.set(starts[I], cursors[I], flag) : void()),
+         ...);
+        flags.push_back(flag);
+        if (chained) {
+          after = {flag};
+        }
+
+        i = j;
+      }
+      return flags;
+    }
+
+    template <typename A, typename O>
+    static auto block_range(Component<O> &o, size_t &cursor,
+                            Component<A> &a, size_t j, std::vector<int> &wait) {
+      // the range of o that comes before a.data[j], starting from cursor
+      // also adds the flags of that range to wait
+      auto first = o.data.begin() + cursor;
+      auto last = o.data.end();
+      if (j < a.data.size()) {
+        last = std::lower_bound(first, o.data.end(), a.data[j].first,
+                                [](const std::pair<uint32_t, O> &a,
+                                   uint32_t b) { return a.first < b; });
+      }
+      size_t next = last - o.data.begin();
+      if (cursor < next) {
+        auto wait_o = o.waiting_flags.get(cursor, next);
+        wait.insert(wait.end(), wait_o.begin(), wait_o.end());
+      }
+      cursor = next;
+      return std::make_pair(first, last);
+    }
+
+    template <typename... I>
+    static bool overlap(std::pair<I, I>... ranges) {
+      // could any id be in all of the (sorted) ranges
+      if (((ranges.first == ranges.second) || ...))
+        return false;
+      return std::max({ranges.first->first...}) <=
+             std::min({std::prev(ranges.second)->first...});
+    }
+
+    template <typename I>
+    static bool seek(std::pair<I, I> &range, uint32_t id) {
+      // move the start of range past all ids below id
+      // and return whether id is found
+      while ((range.first != range.second) && (range.first->first < id)) {
+        ++range.first;
+        ++visits;
+      }
+      return (range.first != range.second) && (range.first->first == id);
+    }
+
+    template <typename A>
+    void apply_pairs(Component<A> &a, float radius, void (*f)(A &, A &)) {
+
+      /*
+       * Runs f(a1, a2) for every pair of entities in a that are
+       * within radius of each other. A needs to work as a 2d position,
+       * i.e. a[0] and a[1] should be the coordinates.
+       * First, a task bins all entities into a grid of cells of size radius.
+       * Then, tiles of cells are processed in parallel, where a cell is paired
+       * with itself and half of its neighbours. The tiles are coloured
+       * like a checkerboard, so that tiles with the same colour never
+       * touch the same entities, and every colour waits for the one before.
+       */
+
+      Call call(*this, f);
+      if ((a.data.size() < 2) || !(radius > 0.0f))
+        return; // no work to do (or no sensible grid, e.g. a NaN radius)
+
+      const int TILE = 4; // tile size, in cells (needs to be at least 2)
+      const int n_colours = 4;
+      int n_tasks = std::max(pool.size(), 1);
+
+      struct Grid {
+        // (cell x, cell y, index into a.data), sorted
+        std::vector<std::tuple<int, int, uint32_t>> cells;
+        // for each colour and task, the cells (index of first entity) to do
+        std::array<std::vector<std::vector<uint32_t>>, 4> work;
+      };
+      auto grid = std::make_shared<Grid>();
+
+      auto build = push_task([grid, radius, n_tasks, TILE,
+                                   first = a.data.begin(),
+                                   last = a.data.end()]() {
+        auto &cells = grid->cells;
+        // far away (or NaN) coordinates go in the cells at the edge
+        // which keeps the cell and its neighbours within int
+        // (the distances are still checked, so nothing wrong is paired)
+        auto cell_of = [radius](float v) {
+          const float LIMIT = 1 << 30;
+          float c = std::floor(v / radius);
+          if (!(c > -LIMIT))
+            return -(1 << 30);
+          if (!(c < LIMIT))
+            return 1 << 30;
+          return static_cast<int>(c);
+        };
+        for (auto it = first; it != last; ++it) {
+          cells.emplace_back(cell_of(it->second[0]), cell_of(it->second[1]),
+                             it - first);
+        }
+        std::sort(cells.begin(), cells.end());
+
+        for (auto &work: grid->work) {
+          work.resize(n_tasks);
+        }
+        for (size_t i = 0; i < cells.size(); ++i) {
+          auto [x, y, _] = cells[i];
+          if ((i > 0) && (std::get<0>(cells[i - 1]) == x) &&
+              (std::get<1>(cells[i - 1]) == y)) {
+            continue; // not the first entity in this cell
+          }
+          // floor division, so that negative cells tile correctly
+          int tx = (x >= 0) ? x/TILE : (x - TILE + 1)/TILE;
+          int ty = (y >= 0) ? y/TILE : (y - TILE + 1)/TILE;
+          int colour = (tx & 1) | ((ty & 1) << 1);
+          // all cells in a tile have to go to the same task
+          uint32_t task = (static_cast<uint32_t>(tx)*0x9e3779b1u) ^
+                          (static_cast<uint32_t>(ty)*0x85ebca77u);
+          grid->work[colour][task % n_tasks].push_back(i);
+        }
+      }, a.waiting_flags.get(0, a.data.size()));
+
+      std::vector<int> wait {build};
+      for (int colour = 0; colour < n_colours; ++colour) {
+        std::vector<int> flags;
+        for (int k = 0; k < n_tasks; ++k) {
+          flags.push_back(push_task([f, grid, radius, colour, k,
+                                          data = a.data.begin()]() {
+            auto &cells = grid->cells;
+            // the range of the cells vector that is in cell (x, y)
+            auto cell = [&cells](int x, int y) {
+              auto first = std::lower_bound(
+                  cells.begin(), cells.end(),
+                  std::make_tuple(x, y, static_cast<uint32_t>(0)));
+              auto last = first;
+              while ((last != cells.end()) && (std::get<0>(*last) == x) &&
+                     (std::get<1>(*last) == y)) {
+                ++last;
+              }
+              return std::make_pair(first, last);
+            };
+            auto close = [&data, radius](uint32_t i, uint32_t j) {
+              float dx = data[i].second[0] - data[j].second[0];
+              float dy = data[i].second[1] - data[j].second[1];
+              return dx*dx + dy*dy <= radius*radius;
+            };
+
+            for (auto start: grid->work[colour][k]) {
+              auto [x, y, _] = cells[start];
+              auto [first, last] = cell(x, y);
+              for (auto i = first; i != last; ++i) {
+                for (auto j = i + 1; j != last; ++j) {
+                  ++visits; // (pairs that were checked)
+                  if (close(std::get<2>(*i), std::get<2>(*j))) {
+                    ++matches;
+                    f(data[std::get<2>(*i)].second, data[std::get<2>(*j)].second);
+                  }
+                }
+              }
+              // half of the neighbours, the other half pairs with this cell
+              const int neighbours[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+              for (auto &[dx, dy]: neighbours) {
+                auto [nfirst, nlast] = cell(x + dx, y + dy);
+                for (auto i = first; i != last; ++i) {
+                  for (auto j = nfirst; j != nlast; ++j) {
+                    ++visits;
+                    if (close(std::get<2>(*i), std::get<2>(*j))) {
+                      ++matches;
+                      f(data[std::get<2>(*i)].second,
+                        data[std::get<2>(*j)].second);
+                    }
+                  }
+                }
+              }
+            }
+          }, wait));
+        }
+        wait = std::move(flags);
+      }
+
+      // everything after this should wait for the last colour
+      auto done = push_task([]() {}, wait);
+      a.waiting_flags.set(0, a.data.size(), done);
+    }
+
+    template <typename A>
+    void apply_hierarchy(Hierarchy &h, Component<A> &a,
+                         void (*f)(A &parent, A &child)) {
+
+      /*
+       * Runs f(parent, child) on the a of every child in h (that has an a)
+       * whose parent also has an a, from the top of the hierarchy down.
+       * The children of one level are split into blocks, that run in parallel,
+       * and every block of a level waits for all the blocks of the level above
+       * (through a task that waits for all of them), so a child is always
+       * done after its parent.
+       * The a of any entity can be written, so the first level waits
+       * for everything in a, and everything after waits for the last level.
+       */
+
+      Call call(*this, f);
+      sort_lazy(a);
+      auto wait = a.waiting_flags.get(0, a.data.size());
+      auto wait_h = h.waiting_flags.get(0, h.data.size());
+      wait.insert(wait.end(), wait_h.begin(), wait_h.end());
+      if (h.order.empty())
+        return; // no work to do
+
+      for (size_t k = 0; k + 1 < h.levels.size(); ++k) {
+        std::vector<int> flags;
+        for (size_t i = h.levels[k]; i < h.levels[k + 1]; i += BLOCK_SIZE) {
+          size_t j = std::min(i + BLOCK_SIZE, h.levels[k + 1]);
+          flags.push_back(push_task([f,
+              first = h.order.begin() + i, last = h.order.begin() + j,
+              data_first = a.data.begin(), data_last = a.data.end()]() {
+            // the lookups don't use operator[], since its cache isn't shared
+            auto find = [&](uint32_t id) -> A * {
+              auto it = std::lower_bound(data_first, data_last, id,
+                                         [](const std::pair<uint32_t, A> &a,
+                                            uint32_t b) { return a.first < b; });
+              return ((it != data_last) && (it->first == id)) ?
+                &(it->second) : nullptr;
+            };
+            for (auto it = first; it != last; ++it) {
+              A *child = find(it->first);
+              A *parent = find(it->second);
+              if (child && parent) {
+                ++matches;
+                f(*parent, *child);
+              }
+            }
+            visits += last - first;
+          }, wait));
+        }
+        if (flags.size() > 1) {
+          wait = {push_task([]() {}, flags)};
+        } else {
+          wait = std::move(flags);
+        }
+      }
+
+      a.waiting_flags.set(0, a.data.size(), wait.front());
+      h.waiting_flags.set(0, h.data.size(), wait.front());
+    }
+
+    /*
+     * The reduction functions take a function like
+     * void foo(R &result, A &a)
+     * and apply it to all entities (with the same rules as apply)
+     * but each task reduces into its own (cache line padded) partial result
+     * so there is no race on the result.
+     * The partial results are combined, by a final task that waits for all
+     * the others, with a function like
+     * void combine(R &result, R &partial)
+     * starting from init (which defaults to the identity).
+     * The result is returned as a future, that is ready when the final task is.
+     * The apply_accumulate versions instead start each partial from R{}
+     * and combine them with +=, onto an initial value (like std::accumulate)
+     */
+
+    template <typename A, typename R>
+    std::future<R> apply_reduce(Component<A> &a, R identity,
+                                void (*f)(R &, A &),
+                                void (*combine)(R &, R &), R init) {
+      Call call(*this, f);
+      auto result = std::make_shared<std::promise<R>>();
+      auto future = result->get_future();
+      if (a.data.size() == 0) {
+        result->set_value(init);
+        return future;
+      }
+
+      int n = (a.data.size() + BLOCK_SIZE - 1)/BLOCK_SIZE;
+      auto partials = std::make_shared<std::vector<Partial<R>>>(
+          n, Partial<R>{identity});
+      std::vector<int> flags;
+      flags.reserve(n);
+
+      for (int k = 0; k < n; ++k) {
+        int i = k*BLOCK_SIZE;
+        int j = std::min(a.data.size(), static_cast<size_t>(i + BLOCK_SIZE));
+        auto wait = a.waiting_flags.get(i, j);
+        auto flag = push_task([f, partials, k,
+                                    first = a.data.begin() + i,
+                                    last = a.data.begin() + j]() {
+          R &partial = (*partials)[k].value;
+          auto it = first;
+          while (it != last) {
+            ++matches;
+            f(partial, it->second);
+            ++it;
+          }
+          visits += last - first;
+        }, wait);
+        a.waiting_flags.set(i, j, flag);
+        flags.push_back(flag);
+      }
+
+      auto done = push_task([combine, partials, result, init]() {
+        R total = init;
+        for (auto &partial: *partials) {
+          combine(total, partial.value);
+        }
+        result->set_value(std::move(total));
+      }, flags);
+      // so that a fence on a is also a fence on the result
+      a.waiting_flags.set(0, a.data.size(), done);
 
-      auto flag = pool.push_task(
-                                 [f, payload,
-           afirst = it_a, alast = a.data.end(),
-           bfirst = it_b, blast = b.data.end(),
-           cfirst = it_c, clast = c.data.end()]() {
-            auto it_a = afirst;
-            auto it_b = bfirst;
-            auto it_c = cfirst;
-            while ((it_a != alast) && (it_b != blast) && (it_c != clast)) {
-              if ((it_a->first == it_b->first) && (it_a->first == it_c->first)) {
-                f(it_a->second, it_b->second, it_c->second, payload);
-                ++it_a;
-                ++it_b;
-                ++it_c;
-              } else if ((it_a->first < it_b->first) ||
-                          (it_a->first < it_c->first)) {
-                ++it_a;
-              } else if ((it_b->first < it_a->first) ||
-                          (it_b->first < it_c->first)) {
-                ++it_b;
-              } else if ((it_c->first < it_a->first) ||
-                          (it_c->first < it_b->first)) {
-                ++it_c;
-              }
-            }
-          }, wait_a);
+      return future;
+    }
 
-      a.waiting_flags.set(it_a - a.data.begin(),
-                          a.data.size(),
-                          flag);
-      b.waiting_flags.set(it_b - b.data.begin(),
-                          b.data.size(),
-                          flag);
-      c.waiting_flags.set(it_c - c.data.begin(),
-                          c.data.size(),
-                          flag);
+    template <typename A, typename R>
+    std::future<R> apply_reduce(Component<A> &a, R identity,
+                                void (*f)(R &, A &),
+                                void (*combine)(R &, R &)) {
+      return apply_reduce(a, identity, f, combine, identity);
     }
 
-    // below are versions of apply that exclude some components
+    template <typename A, typename R>
+    std::future<R> apply_accumulate(Component<A> &a, R init,
+                                    void (*f)(R &, A &)) {
+      return apply_reduce(a, R{}, f,
+                          +[](R &total, R &partial) { total += partial; },
+                          init);
+    }
 
-    template <typename A, typename B>
-    void apply(Component<A> &a, void (*f)(A &), Component<B> &b) {
-      if ((a.data.size() == 0) || (b.data.size() == 0))
-        return;
+    template <typename A, typename B, typename R>
+    std::future<R> apply_reduce(Component<A> &a, Component<B> &b, R identity,
+                                void (*f)(R &, A &, B &),
+                                void (*combine)(R &, R &), R init) {
+      Call call(*this, f);
+      sort_lazy(a, b);
+      auto result = std::make_shared<std::promise<R>>();
+      auto future = result->get_future();
+      if ((a.data.size() == 0) || (b.data.size() == 0)) {
+        result->set_value(init);
+        return future;
+      }
 
       int n = (a.data.size() + b.data.size())/BLOCK_SIZE/2;
       n = std::max(n, 1);
@@ -1038,21 +4642,38 @@ namespace ecs {
         breaks.push_back((a.data[i*a_step].first + b.data[i*b_step].first) / 2);
       }
 
+      auto partials = std::make_shared<std::vector<Partial<R>>>(
+          n, Partial<R>{identity});
+      std::vector<int> flags;
+      flags.reserve(n);
+
       auto it_a = a.data.begin();
       auto it_b = b.data.begin();
 
-      for (auto breakpoint: breaks) {
-        // find an iterator to the entity with id = breakpoint in each list
-        auto it_a_break =
-            std::lower_bound(a.data.begin(), a.data.end(), breakpoint,
-                             [](const std::pair<uint32_t, A> &a, uint32_t b) {
-                               return a.first < b;
-                             });
-        auto it_b_break =
-            std::lower_bound(b.data.begin(), b.data.end(), breakpoint,
-                             [](const std::pair<uint32_t, B> &a, uint32_t b) {
-                               return a.first < b;
-                             });
+      for (int k = 0; k < n; ++k) {
+        // the last block goes to the end of both lists
+        auto it_a_break = a.data.end();
+        auto it_b_break = b.data.end();
+        if (k < n - 1) {
+          it_a_break =
+              std::lower_bound(a.data.begin(), a.data.end(), breaks[k],
+                               [](const std::pair<uint32_t, A> &a, uint32_t b) {
+                                 return a.first < b;
+                               });
+          it_b_break =
+              std::lower_bound(b.data.begin(), b.data.end(), breaks[k],
+                               [](const std::pair<uint32_t, B> &a, uint32_t b) {
+                                 return a.first < b;
+                               });
+        }
+
+        if (!overlap(std::make_pair(it_a, it_a_break),
+                     std::make_pair(it_b, it_b_break))) {
+          // no id can be in all of them, so there's nothing to do
+          it_a = it_a_break;
+          it_b = it_b_break;
+          continue;
+        }
 
         auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
                                           it_a_break - a.data.begin());
@@ -1060,21 +4681,25 @@ namespace ecs {
                                           it_b_break - b.data.begin());
         wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-        auto flag = pool.push_task(
-            [f,
+        auto flag = push_task(
+            [f, partials, k,
              afirst = it_a, alast = it_a_break,
-             bfirst = it_b, blast = it_b_break]() {
+             bfirst = it_b, blast = it_b_break,
+             za = &a.zones, zb = &b.zones]() {
+              R &partial = (*partials)[k].value;
               auto it_a = afirst;
               auto it_b = bfirst;
               while ((it_a != alast) && (it_b != blast)) {
                 if (it_a->first == it_b->first) {
+                  ++matches;
+                  visits += 2;
+                  f(partial, it_a->second, it_b->second);
                   ++it_a;
                   ++it_b;
                 } else if (it_a->first < it_b->first) {
-                  f(it_a->second);
-                  ++it_a;
+                  it_a = za->seek(it_a, alast, it_b->first);
                 } else {
-                  ++it_b;
+                  it_b = zb->seek(it_b, blast, it_a->first);
                 }
               }
             }, wait_a);
@@ -1085,142 +4710,267 @@ namespace ecs {
         b.waiting_flags.set(it_b - b.data.begin(),
                             it_b_break - b.data.begin(),
                             flag);
+        flags.push_back(flag);
 
         it_a = it_a_break;
         it_b = it_b_break;
       }
 
-      auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
-                                        a.data.size());
-      auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
-                                        b.data.size());
-      wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
-
-      auto flag = pool.push_task([f, afirst = it_a, alast = a.data.end(),
-                                bfirst = it_b, blast = b.data.end()]() {
-        auto it_a = afirst;
-        auto it_b = bfirst;
-        while ((it_a != alast) && (it_b != blast)) {
-          if (it_a->first == it_b->first) {
-            ++it_a;
-            ++it_b;
-          } else if (it_a->first < it_b->first) {
-            f(it_a->second);
-            ++it_a;
-          } else {
-            ++it_b;
-          }
+      auto done = push_task([combine, partials, result, init]() {
+        R total = init;
+        for (auto &partial: *partials) {
+          combine(total, partial.value);
         }
-      }, wait_a);
+        result->set_value(std::move(total));
+      }, flags);
+      // so that a fence on a (or b) is also a fence on the result
+      a.waiting_flags.set(0, a.data.size(), done);
+      b.waiting_flags.set(0, b.data.size(), done);
 
-      a.waiting_flags.set(it_a - a.data.begin(),
-                          a.data.size(),
-                          flag);
-      b.waiting_flags.set(it_b - b.data.begin(),
-                          b.data.size(),
-                          flag);
+      return future;
     }
 
-    template <typename A, typename B>
-    void apply(Component<A> &a, void (*f)(A &, B &, void *), void *payload,
-               Component<B> &b) {
-      if ((a.data.size() == 0) || (b.data.size() == 0))
-        return;
+    template <typename A, typename B, typename R>
+    std::future<R> apply_reduce(Component<A> &a, Component<B> &b, R identity,
+                                void (*f)(R &, A &, B &),
+                                void (*combine)(R &, R &)) {
+      return apply_reduce(a, b, identity, f, combine, identity);
+    }
 
-      int n = (a.data.size() + b.data.size())/BLOCK_SIZE/2;
-      n = std::max(n, 1);
-      int a_step = a.data.size()/n;
-      int b_step = b.data.size()/n;
+    template <typename A, typename B, typename R>
+    std::future<R> apply_accumulate(Component<A> &a, Component<B> &b, R init,
+                                    void (*f)(R &, A &, B &)) {
+      return apply_reduce(a, b, R{}, f,
+                          +[](R &total, R &partial) { total += partial; },
+                          init);
+    }
+  };
 
-      std::vector<int> breaks;
-      breaks.reserve(n);
-      for (int i = 1; i < n; ++i) {
-        breaks.push_back((a.data[i*a_step].first + b.data[i*b_step].first) / 2);
+
+  template <typename T, typename... Ts>
+  constexpr bool contains = (std::is_same_v<T, Ts> || ...);
+
+  template <typename... C> struct Reads {};
+  template <typename... C> struct Writes {};
+
+  template <typename R, typename W> struct Access;
+
+  template <typename... R, typename... W>
+  struct Access<Reads<R...>, Writes<W...>> {
+
+    /*
+     * What a system reads and writes, as component types, so that
+     * conflicts between systems are known at compile time, like
+     *   using Move = Access<Reads<Component<Velocity>>,
+     *                       Writes<Component<Position>>>;
+     *   static_assert(!conflicts<Move, Gravity>);
+     */
+
+    template <typename T> static constexpr bool reads = contains<T, R...>;
+    template <typename T> static constexpr bool writes = contains<T, W...>;
+
+    // one writes what the other reads or writes
+    template <typename Other>
+    static constexpr bool conflicts =
+        ((Other::template reads<W> || Other::template writes<W>) || ...) ||
+        (Other::template writes<R> || ...);
+
+    // everything accessed is one of Cs
+    template <typename... Cs>
+    static constexpr bool within =
+        (contains<R, Cs...> && ...) && (contains<W, Cs...> && ...);
+
+    template <typename World>
+    static std::vector<ComponentInterface *> read_list(World &world) {
+      return {&world.template get<R>()...};
+    }
+
+    template <typename World>
+    static std::vector<ComponentInterface *> write_list(World &world) {
+      return {&world.template get<W>()...};
+    }
+  };
+
+  template <typename A, typename B>
+  constexpr bool conflicts = A::template conflicts<B>;
+
+  template <typename X, typename... A>
+  constexpr std::array<bool, sizeof...(A)> conflict_row() {
+    return {conflicts<X, A>...};
+  }
+
+  template <typename... A>
+  constexpr std::array<int, sizeof...(A)> stages() {
+    // the stage of every system, as Manager::schedule would put them
+    constexpr size_t N = sizeof...(A);
+    std::array<std::array<bool, N>, N> conflict {};
+    size_t row = 0;
+    ((conflict[row++] = conflict_row<A, A...>()), ...);
+    std::array<int, N> stage {};
+    for (size_t i = 0; i < N; ++i) {
+      for (size_t j = 0; j < i; ++j) {
+        if (conflict[i][j]) {
+          stage[i] = std::max(stage[i], stage[j] + 1);
+        }
       }
+    }
+    return stage;
+  }
 
-      auto it_a = a.data.begin();
-      auto it_b = b.data.begin();
 
-      for (auto breakpoint: breaks) {
-        // find an iterator to the entity with id = breakpoint in each list
-        auto it_a_break =
-            std::lower_bound(a.data.begin(), a.data.end(), breakpoint,
-                             [](const std::pair<uint32_t, A> &a, uint32_t b) {
-                               return a.first < b;
-                             });
-        auto it_b_break =
-            std::lower_bound(b.data.begin(), b.data.end(), breakpoint,
-                             [](const std::pair<uint32_t, B> &a, uint32_t b) {
-                               return a.first < b;
-                             });
+  template <typename T>
+  std::string type_name() {
+    // T as the compiler spells it, e.g. Component<Position>
+    // (taken from our own signature, which has it as "T = ...")
+    std::string_view name = std::source_location::current().function_name();
+    auto first = name.find("T = ");
+    if (first == std::string_view::npos)
+      return std::string(name); // still names T, just not as neatly
+    first += 4;
+    auto last = name.find_first_of(";]", first);
+    return std::string(name.substr(first, last - first));
+  }
 
-        auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
-                                          it_a_break - a.data.begin());
-        auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
-                                          it_b_break - b.data.begin());
-        wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
 
-        auto flag = pool.push_task(
-                                   [f, payload,
-             afirst = it_a, alast = it_a_break,
-             bfirst = it_b, blast = it_b_break]() {
-              auto it_a = afirst;
-              auto it_b = bfirst;
-              while ((it_a != alast) && (it_b != blast)) {
-                if (it_a->first == it_b->first) {
-                  ++it_a;
-                  ++it_b;
-                } else if (it_a->first < it_b->first) {
-                  f(it_a->second, payload);
-                  ++it_a;
-                } else {
-                  ++it_b;
-                }
-              }
-            }, wait_a);
+  template <typename... C>
+  struct World : Manager {
 
-        a.waiting_flags.set(it_a - a.data.begin(),
-                            it_a_break - a.data.begin(),
-                            flag);
-        b.waiting_flags.set(it_b - b.data.begin(),
-                            it_b_break - b.data.begin(),
-                            flag);
+    /*
+     * A Manager that owns a fixed set of components, known at compile time.
+     * They're still enlisted, so everything a Manager does works as usual,
+     * but update, destroy and debug_print_entity_components go through
+     * the components directly (no lookups, and with their types known),
+     * and then through any others enlisted in it as a Manager would,
+     * and systems declare their Access as types, which is checked against
+     * the components (and against each other, see conflicts and stages).
+     * The component types have to be distinct (so wrap the value types
+     * in structs if two components would otherwise be the same)
+     * and default constructible. Those that aren't given a name
+     * are enlisted under the name of their type (see type_name).
+     */
 
-        it_a = it_a_break;
-        it_b = it_b_break;
+    static_assert(sizeof...(C) > 0, "a world needs components");
+
+    template <typename T, typename... Ts>
+    static constexpr size_t index_of() {
+      constexpr std::array<bool, sizeof...(Ts)> same {std::is_same_v<T, Ts>...};
+      for (size_t i = 0; i < same.size(); ++i) {
+        if (same[i])
+          return i;
       }
+      return same.size();
+    }
 
-      auto wait_a = a.waiting_flags.get(it_a - a.data.begin(),
-                                        a.data.size());
-      auto wait_b = b.waiting_flags.get(it_b - b.data.begin(),
-                                        b.data.size());
-      wait_a.insert(wait_a.end(), wait_b.begin(), wait_b.end());
+    World() : World(std::array<std::string, sizeof...(C)> {}) {}
 
-      auto flag = pool.push_task([f, payload,
-                                  afirst = it_a, alast = a.data.end(),
-                                  bfirst = it_b, blast = b.data.end()]() {
-        auto it_a = afirst;
-        auto it_b = bfirst;
-        while ((it_a != alast) && (it_b != blast)) {
-          if (it_a->first == it_b->first) {
-            ++it_a;
-            ++it_b;
-          } else if (it_a->first < it_b->first) {
-            f(it_a->second, payload);
-            ++it_a;
-          } else {
-            ++it_b;
-          }
+    World(std::array<std::string, sizeof...(C)> names) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        static_assert(((index_of<C, C...>() == I) && ...),
+                      "the components of a world have to be distinct");
+        (enlist(&std::get<I>(storage),
+                names[I].empty() ? type_name<C>() : names[I]), ...);
+      }(std::index_sequence_for<C...>{});
+    }
+
+    ~World() {
+      // the components go before the pool, so nothing may still use them
+      wait();
+    }
+
+    template <typename T>
+    T &get() {
+      static_assert(index_of<T, C...>() < sizeof...(C),
+                    "not a component of this world");
+      return std::get<index_of<T, C...>()>(storage);
+    }
+
+    template <size_t I>
+    auto &get() { return std::get<I>(storage); }
+
+    template <typename T>
+    bool has(uint32_t id, T &component) {
+      if (component.index < 0)
+        return component.T::exists(id);
+      return (id < signatures.size()) && signatures[id][component.index];
+    }
+
+    using Manager::update;
+
+    void update() {
+      // the components of the world are enlisted first, so any others
+      // (resources, event channels...) come after them
+      wait_async();
+      std::apply([this](auto &... component) {
+        (update_component(component), ...);
+      }, storage);
+      for (size_t i = sizeof...(C); i < components.size(); ++i) {
+        Manager::update_component(*components[i]);
+      }
+      finish_update();
+    }
+
+    template <typename T>
+    requires (index_of<T, C...>() < sizeof...(C))
+    void update(T &component) {
+      // like Manager::update, but with the type known
+      wait_async();
+      if (!component.T::pending()) {
+        pool.wait_for(component.T::waiting());
+        return;
+      }
+      update_component(component);
+    }
+
+    template <typename T>
+    void update_component(T &component) {
+      // like Manager::update_component, but the calls are qualified
+      // so they don't go through ComponentInterface
+      if (!component.T::pending())
+        return;
+      pool.wait_for(component.T::waiting());
+      component.T::clear_waiting();
+      component.T::update();
+      write_journal(component);
+      component.T::shrink(shrink_policy);
+    }
+
+    void destroy(uint32_t id) {
+      [&]<typename... T>(T &... component) {
+        ((has(id, component) ? component.T::destroy(id) : void()), ...);
+      }(std::get<C>(storage)...);
+      for (size_t i = sizeof...(C); i < components.size(); ++i) {
+        if (Manager::has(id, *components[i])) {
+          components[i]->destroy(id);
         }
-      }, wait_a);
+      }
+      return_id(id);
+    }
 
-      a.waiting_flags.set(it_a - a.data.begin(),
-                          a.data.size(),
-                          flag);
-      b.waiting_flags.set(it_b - b.data.begin(),
-                          b.data.size(),
-                          flag);
+    void debug_print_entity_components(uint32_t id) {
+      std::cout << id << " : ";
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        ((has(id, std::get<I>(storage)) ?
+          void(std::cout << component_names[I] << ' ') : void()), ...);
+      }(std::index_sequence_for<C...>{});
+      for (size_t i = sizeof...(C); i < components.size(); ++i) {
+        if (Manager::has(id, *components[i])) {
+          std::cout << component_names[i] << ' ';
+        }
+      }
+      std::cout << std::endl;
+    }
+
+    using Manager::add_system;
+
+    template <typename A>
+    void add_system(std::string name, std::function<void(World &)> run) {
+      static_assert(A::template within<C...>,
+                    "a system accesses a component that isn't in the world");
+      Manager::add_system(name, A::read_list(*this), A::write_list(*this),
+                          [this, run](Manager &) { run(*this); });
     }
+
+    std::tuple<C...> storage;
   };
 
 } // end namespace ecs
@@ -1229,8 +4979,8 @@ namespace ecs {
 template <typename T>
 inline std::ostream &operator<<(std::ostream &out, ecs::IntervalMap<T> &im) {
   out << '[';
-  for (auto &[first, last, value] : im.data) {
-    out << '(' << first << ' ' << value << ' ' << last << ')';
+  for (auto &[first, interval] : im.data) {
+    out << '(' << first << ' ' << interval.second << ' ' << interval.first << ')';
   }
   out << ']';
   return out;
@@ -1240,9 +4990,9 @@ inline std::ostream &operator<<(std::ostream &out, ecs::Flowpool &pool) {
   std::scoped_lock lock(pool.tasks_mutex);
   std::cout << pool.n_tasks << " unfinished out of " << pool.total_tasks
             << " total" << std::endl;
-  for (int i = 0; i < pool.total_tasks; ++i) {
+  for (int i = pool.base; i < pool.total_tasks; ++i) {
     std::string flag;
-    switch (pool.flags[i]) {
+    switch (pool.status(i)) {
     case ecs::Flowpool::WAITING:
       flag = "waiting";
       break;
@@ -1252,9 +5002,11 @@ inline std::ostream &operator<<(std::ostream &out, ecs::Flowpool &pool) {
     case ecs::Flowpool::DONE:
       flag = "done";
       break;
+    case ecs::Flowpool::NUM_TASK_STATUS:
+      break;
     }
     std::cout << '(' << i << ' ' << flag;
-    for (auto &w : pool.conditions[i]) {
+    for (auto &w : pool.conditions[i - pool.base]) {
       std::cout << ' ' << w;
     }
     std::cout << ')' << std::endl;
@@ -1272,3 +5024,8 @@ inline std::ostream &operator<<(std::ostream &out, ecs::Component<T> &c) {
   return out;
 }
 
+template <typename T>
+inline std::ostream &operator<<(std::ostream &out, ecs::ReadOnly<T> c) {
+  return out << c.component;
+}
+
@@ -0,0 +1,94 @@
+#include <future>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a system can be a coroutine, that waits for the result of one apply
+// to decide what to apply next, without blocking the main thread
+
+void grow(int &x) { x += 1; }
+void shrink(int &x) { x -= 10; }
+void count(int &total, int &x) { total += x; }
+void slow(float &y) {
+  for (int i = 0; i < 1000; ++i) {
+    y = y*0.5f + 1.0f;
+  }
+}
+
+ecs::Async balance(ecs::Manager &ecs, ecs::Component<int> &a, int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    ecs.apply(a, grow);
+    auto total = ecs.apply_accumulate(a, 0, count);
+    co_await ecs.fence(a); // resumed on a worker once the total is done
+    if (total.get() > 2300) {
+      ecs.apply(a, shrink);
+    }
+  }
+  co_await ecs.fence();
+}
+
+void add(int &x, float &y) { y += x; }
+
+ecs::Async join(ecs::Manager &ecs, ecs::Component<int> &a,
+                ecs::Component<float> &b, std::promise<void> &resumed,
+                std::future<void> go) {
+  ecs.apply(a, grow);
+  co_await ecs.fence(a);
+  // the coroutine can block (here on its only worker) and the main thread
+  // can still schedule meanwhile, since nothing is held while it runs
+  resumed.set_value();
+  go.wait();
+  ecs.apply(a, b, add); // a is lazy and unsorted, so this waits to sort it
+  co_await ecs.fence();
+}
+
+int main() {
+  ecs::Manager ecs(4);
+  ecs::Component<int> a;
+  ecs::Component<float> b;
+  ecs.enlist(&a, "a");
+  ecs.enlist(&b, "b");
+  for (int i = 0; i < 1000; ++i) {
+    auto id = ecs.get_id();
+    a.create(id, 1);
+    b.create(id, 0.0f);
+  }
+  ecs.update();
+
+  auto system = balance(ecs, a, 5);
+  // the main thread can keep scheduling other things meanwhile
+  ecs.apply(b, slow);
+  system.wait();
+  ecs.update();
+  std::cout << ecs.apply_accumulate(a, 0, count).get() << ' ' << *b[1]
+            << std::endl;
+  // frames: 2000, 3000 -> shrink to -7000, -6000, -5000, -4000
+
+  {
+    ecs::Manager ecs(1);
+    ecs::Component<int> a;
+    ecs::Component<float> b;
+    a.set_lazy(true);
+    ecs.enlist(&a, "a");
+    ecs.enlist(&b, "b");
+    for (int i = 0; i < 4; ++i) {
+      auto id = ecs.get_id();
+      a.create(id, i);
+      b.create(id, 0.0f);
+    }
+    ecs.update();
+    ecs.destroy(1); // moves the last a into its place
+    ecs.update();
+
+    std::promise<void> resumed, go;
+    auto system = join(ecs, a, b, resumed, go.get_future());
+    resumed.get_future().wait();
+    std::cout << ecs.get_id() << ' '; // while the coroutine is blocked
+    go.set_value();
+    system.wait();
+    ecs.update();
+    std::cout << b << std::endl;
+  }
+  // -4000 2
+  // 1 [(2 2)(3 3)(4 4)]
+}
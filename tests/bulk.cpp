@@ -0,0 +1,58 @@
+#include <iostream>
+#include <vector>
+
+#include "ecsoplatm.h"
+
+// entities can be created in bulk, which is much faster than one by one
+// since a contiguous range of ids is already sorted
+
+int main() {
+  ecs::Manager ecs;
+
+  ecs::Component<int> a;
+  ecs::Component<int> b;
+  ecs::Component<int> c;
+  ecs.enlist(&a, "a");
+  ecs.enlist(&b, "b");
+  ecs.enlist(&c, "c");
+
+  auto ids = ecs.get_ids(100000);
+  std::vector<int> values(ids.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = i;
+  }
+  a.create_bulk(ids, values);
+  ecs.update();
+
+  // or for arbitrary ids
+  std::vector<uint32_t> some_ids {7, 3, 99999, 5};
+  std::vector<int> some_values {70, 30, 999990, 50};
+  b.create_bulk(some_ids, some_values);
+  ecs.update();
+
+  for (uint32_t i = 1; i < 100000; i *= 10) {
+    ecs.destroy(i);
+  }
+  ecs.update();
+
+  std::cout << ids.first << ' ' << ids.last << std::endl;
+  std::cout << a.data.size() << ' ' << *a[2] << ' ' << *a[99999] << std::endl;
+  std::cout << b << std::endl;
+
+  // only as many as there are both ids and values for are created
+  std::vector<uint32_t> more_ids {11, 12, 13};
+  std::vector<int> fewer_values {110};
+  c.create_bulk(more_ids, fewer_values);
+  ecs.update();
+  std::cout << c << std::endl;
+
+  // the range is shorter if the ids run out
+  ecs.max_unused_id = std::numeric_limits<uint32_t>::max() - 10;
+  std::cout << ecs.get_ids(100).size() << ' ' << ecs.get_ids(100).size()
+            << std::endl;
+  // 1 100001
+  // 99995 1 99998
+  // [(3 30)(5 50)(7 70)(99999 999990)]
+  // [(11 110)]
+  // 10 0
+}
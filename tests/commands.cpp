@@ -0,0 +1,43 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// create and destroy can be called from within systems
+// they are queued per worker thread, and executed in the next update
+
+void spread(int &heat, void *payload) {
+  auto components = static_cast<ecs::Component<int> **>(payload);
+  // we don't know our own id here, but heat was set to the id
+  if (heat % 2 == 0) {
+    components[1]->create(heat, 1); // even entities catch fire
+  } else {
+    components[0]->destroy(heat); // and odd ones cool down
+  }
+}
+
+int main() {
+  ecs::Manager ecs(4);
+
+  ecs::Component<int> heat;
+  ecs::Component<int> flame;
+  ecs.enlist(&heat, "heat");
+  ecs.enlist(&flame, "flame");
+
+  for (int i = 0; i < 2000; ++i) {
+    auto id = ecs.get_id();
+    heat.create(id, id);
+  }
+  ecs.update();
+
+  ecs::Component<int> *payload[] = {&heat, &flame};
+  ecs.apply(heat, &spread, payload);
+  ecs.wait();
+  ecs.update();
+
+  std::cout << heat.data.size() << ' ' << flame.data.size() << std::endl;
+  // 1000 1000
+
+  for (int i = 1; i < 8; ++i) {
+    ecs.debug_print_entity_components(i);
+  }
+}
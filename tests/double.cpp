@@ -0,0 +1,56 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// with double buffering, systems read the previous state from the front
+// and write the next state into the back, so they don't depend on each other
+// and the result doesn't depend on the order they're applied in
+
+// (the fronts are read only, so they're passed as const)
+void chase(const int &prey, const int &hunter, int &next) { next = hunter + (prey - hunter)/2; }
+void flee(const int &prey, const int &hunter, int &next) { next = prey + (prey - hunter < 8 ? 3 : 1); }
+
+int main() {
+  ecs::Manager ecs;
+  ecs::DoubleBuffered<ecs::Component<int>> prey;
+  ecs::DoubleBuffered<ecs::Component<int>> hunter;
+  ecs.enlist(&prey, "prey");
+  ecs.enlist(&hunter, "hunter");
+
+  for (int i = 0; i < 4; ++i) {
+    auto id = ecs.get_id();
+    prey.create(id, 10*i + 10);
+    hunter.create(id, 10*i);
+  }
+  ecs.update();
+
+  for (int frame = 0; frame < 3; ++frame) {
+    // the first two only read the fronts, so they don't wait for each other
+    ecs.apply(prey.front(), hunter.front(), hunter.back(), chase);
+    ecs.apply(prey.front(), hunter.front(), prey.back(), flee);
+    ecs.update();
+    std::cout << prey.front() << ' ' << hunter.front() << std::endl;
+  }
+
+  // structural changes go through the back, and show up in the front
+  ecs.destroy(2);
+  ecs.update();
+  std::cout << prey.front() << ' ' << hunter.front() << std::endl;
+  std::cout << (prey.front()->data == prey.back().data) << std::endl;
+
+  // the back is only copied into the front if it could have changed
+  std::cout << prey.stale() << ' ';
+  ecs.apply(prey.front(), hunter.front(), hunter.back(), chase);
+  std::cout << prey.stale() << hunter.stale() << ' ';
+  *prey[3] = 0; // (written through the pointer)
+  std::cout << prey.stale() << ' ';
+  ecs.update();
+  std::cout << prey.stale() << hunter.stale() << ' ' << prey.front() << ' '
+            << hunter.front() << std::endl;
+  // [(1 11)(2 21)(3 31)(4 41)] [(1 5)(2 15)(3 25)(4 35)]
+  // [(1 14)(2 24)(3 34)(4 44)] [(1 8)(2 18)(3 28)(4 38)]
+  // [(1 17)(2 27)(3 37)(4 47)] [(1 11)(2 21)(3 31)(4 41)]
+  // [(1 17)(3 37)(4 47)] [(1 11)(3 31)(4 41)]
+  // 1
+  // 0 01 1 00 [(1 17)(3 0)(4 47)] [(1 14)(3 34)(4 44)]
+}
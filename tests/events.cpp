@@ -0,0 +1,64 @@
+#include <atomic>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// systems can send events to each other through a channel
+// and a consumer sees all the events that were sent before it was applied
+
+struct Hit {
+  int damage;
+};
+
+std::atomic<int> n_hits {0};
+std::atomic<int> total {0};
+
+void fire(int &power, ecs::EventChannel<Hit> &hits) {
+  if (power % 3 == 0) {
+    hits.send({power});
+  }
+}
+
+void fire_twice(int &power, double &, ecs::EventChannel<Hit> &hits) {
+  hits.send({power});
+  hits.send({power});
+}
+
+void count(Hit &hit) {
+  ++n_hits;
+  total += hit.damage;
+}
+
+int main() {
+  ecs::Manager ecs(4);
+  ecs::Component<int> power;
+  ecs::Component<double> rate;
+  ecs::EventChannel<Hit> hits;
+  ecs.enlist(&power, "power");
+  ecs.enlist(&rate, "rate");
+  ecs.enlist(&hits, "hits");
+
+  for (int i = 0; i < 1000; ++i) {
+    auto id = ecs.get_id();
+    power.create(id, i);
+    if (i < 10) rate.create(id, 1.0);
+  }
+  ecs.update();
+
+  for (int frame = 0; frame < 2; ++frame) {
+    n_hits = 0;
+    total = 0;
+    ecs.apply(power, fire, hits);
+    ecs.apply(power, rate, fire_twice, hits);
+    hits.send({1000}); // from the main thread
+    ecs.apply(hits, count);
+    ecs.wait();
+    std::cout << n_hits << ' ' << total << ' ' << hits.events.size() << std::endl;
+    ecs.update(); // clears the channel
+    std::cout << hits.events.size() << std::endl;
+  }
+  // 355 167923 355
+  // 0
+  // 355 167923 355
+  // 0
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a hierarchy stores the parent of each entity, and apply_hierarchy
+// propagates from parents to children, one depth level at a time
+
+struct Transform {
+  float local;
+  float world;
+};
+
+void to_world(Transform &t) { t.world = t.local; }
+void propagate(Transform &parent, Transform &child) {
+  child.world = parent.world + child.local;
+}
+
+int main() {
+  ecs::Manager ecs(4);
+  ecs::Hierarchy parent;
+  ecs::Component<Transform> transform;
+  ecs.enlist(&parent, "parent");
+  ecs.enlist(&transform, "transform");
+
+  // a root with 1000 children, and a chain of grandchildren below the last
+  // (created in reverse, so that ids don't follow depth)
+  auto root = ecs.get_id();
+  auto ids = ecs.get_ids(1004);
+  transform.create(root, {100.0f, 0.0f});
+  for (uint32_t i = 0; i < 1000; ++i) {
+    transform.create(ids.first + i, {static_cast<float>(i), 0.0f});
+    parent.create(ids.first + i, root);
+  }
+  for (uint32_t i = 1000; i < 1004; ++i) {
+    transform.create(ids.first + i, {1.0f, 0.0f});
+    parent.create(ids.first + i, (i == 1003) ? ids.first + 999 : ids.first + i + 1);
+  }
+  // a cycle, which is left out
+  auto a = ecs.get_id();
+  auto b = ecs.get_id();
+  parent.create(a, b);
+  parent.create(b, a);
+  ecs.update();
+
+  std::cout << parent.depth() << ' ' << parent.order.size() << std::endl;
+  ecs.apply(transform, to_world);
+  ecs.apply_hierarchy(parent, transform, propagate);
+  ecs.wait();
+  for (uint32_t i: {0u, 1u, 999u, 1000u, 1001u, 1002u, 1003u}) {
+    std::cout << transform[ids.first + i]->world << ' ';
+  }
+  std::cout << std::endl;
+
+  // move the chain to the first child
+  parent.reparent(ids.first + 1003, ids.first);
+  ecs.update();
+  ecs.apply(transform, to_world);
+  ecs.apply_hierarchy(parent, transform, propagate);
+  ecs.wait();
+  std::cout << transform[ids.first + 1000]->world << std::endl;
+  // 5 1004
+  // 100 101 1099 1103 1102 1101 1100
+  // 104
+}
@@ -0,0 +1,138 @@
+#include <filesystem>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// with a journal, every update appends what changed to a file
+// so any later frame can be rebuilt from a snapshot and the journal
+
+struct Position {
+  float x, y;
+};
+
+std::ostream &operator<<(std::ostream &out, const Position &p) {
+  return out << p.x << ',' << p.y;
+}
+
+bool operator==(const Position &a, const Position &b) {
+  return (a.x == b.x) && (a.y == b.y);
+}
+
+void step(Position &p) { p.x += 1.0f; }
+void keep(double &) {}
+
+int main() {
+  auto dir = std::filesystem::temp_directory_path();
+  auto base = (dir/"ecsoplatm_base.bin").string();
+  auto journal_path = (dir/"ecsoplatm_journal.bin").string();
+  auto frame_path = (dir/"ecsoplatm_frame.bin").string();
+  std::filesystem::remove(journal_path);
+  {
+    ecs::Manager ecs;
+    ecs::Journal journal(journal_path);
+    ecs::Component<Position> position;
+    ecs::Component<int> health;
+    ecs::Component<double> mass; // (padded between the id and the value)
+    position.set_track_changes(true); // also record the changed values
+    mass.set_track_changes(true);
+    ecs.enlist(&position, "position");
+    ecs.enlist(&health, "health");
+    ecs.enlist(&mass, "mass");
+    ecs.record(&journal);
+
+    for (int i = 0; i < 4; ++i) {
+      auto id = ecs.get_id();
+      position.create(id, {static_cast<float>(i), 0.0f});
+      health.create(id, 10*i);
+      mass.create(id, 1.5);
+    }
+    ecs.update();
+    std::cout << ecs.save(base) << ' ' << ecs.frame
+              << std::endl; // frame 1
+
+    ecs.apply(position, step);
+    ecs.apply(mass, keep);
+    ecs.destroy(2);
+    ecs.update(); // frame 2
+    // only the ids and values are compared, so no mass changed
+    std::cout << mass.delta.modified.empty() << std::endl;
+    auto id = ecs.get_id();
+    position.create(id, {-1.0f, -1.0f});
+    ecs.update(); // frame 3
+    ecs.apply(position, step);
+    ecs.update(); // frame 4
+    std::cout << position << std::endl;
+  }
+
+  for (uint64_t frame: {2, 3, 4}) {
+    std::cout << ecs::rebuild_snapshot(base, journal_path, frame,
+                                       frame_path) << std::endl;
+    ecs::Manager ecs;
+    ecs::Component<Position> position;
+    ecs::Component<int> health;
+    ecs.enlist(&position, "position");
+    ecs.enlist(&health, "health");
+    ecs.load(frame_path);
+    std::cout << position << std::endl;
+    std::cout << health << std::endl;
+  }
+
+  // changes are tracked from the moment tracking starts
+  // (even if nothing was updated since, here or after a load)
+  std::filesystem::remove(journal_path);
+  auto modified = [](ecs::Component<Position> &position) {
+    return position.delta.modified.size()/sizeof(std::pair<uint32_t, Position>);
+  };
+  {
+    ecs::Manager ecs;
+    ecs::Component<Position> position;
+    ecs.enlist(&position, "position");
+    for (int i = 0; i < 3; ++i) {
+      position.create(ecs.get_id(), {static_cast<float>(i), 0.0f});
+    }
+    ecs.update();
+    ecs::Journal journal(journal_path);
+    position.set_track_changes(true);
+    ecs.record(&journal);
+    ecs.save(base);
+    ecs.apply(position, step);
+    ecs.update();
+    std::cout << modified(position) << std::endl;
+  }
+  std::cout << ecs::rebuild_snapshot(base, journal_path, 2, frame_path)
+            << std::endl;
+  {
+    ecs::Manager ecs;
+    ecs::Journal journal(frame_path + ".journal");
+    ecs::Component<Position> position;
+    position.set_track_changes(true);
+    ecs.enlist(&position, "position");
+    ecs.record(&journal);
+    ecs.load(frame_path);
+    std::cout << position << std::endl;
+    ecs.apply(position, step);
+    ecs.update();
+    std::cout << modified(position) << std::endl;
+  }
+  std::filesystem::remove(frame_path + ".journal");
+
+  std::filesystem::remove(base);
+  std::filesystem::remove(journal_path);
+  std::filesystem::remove(frame_path);
+  // 1 1
+  // 1
+  // [(1 2,0)(2 0,-1)(3 4,0)(4 5,0)]
+  // 1
+  // [(1 1,0)(3 3,0)(4 4,0)]
+  // [(1 0)(3 20)(4 30)]
+  // 1
+  // [(1 1,0)(2 -1,-1)(3 3,0)(4 4,0)]
+  // [(1 0)(3 20)(4 30)]
+  // 1
+  // [(1 2,0)(2 0,-1)(3 4,0)(4 5,0)]
+  // [(1 0)(3 20)(4 30)]
+  // 3
+  // 1
+  // [(1 1,0)(2 2,0)(3 3,0)]
+  // 3
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a lazy component isn't kept sorted, so creating and destroying is cheap
+// and it's only sorted when it's joined with another component
+
+void age(int &a) { ++a; }
+void scale(int &a, float &b) { b *= a; }
+
+int main() {
+  ecs::Manager ecs;
+  ecs::Component<int> ages;
+  ecs::Component<float> sizes;
+  ages.set_lazy(true);
+  ecs.enlist(&ages, "ages");
+  ecs.enlist(&sizes, "sizes");
+
+  std::vector<uint32_t> ids;
+  for (int i = 0; i < 6; ++i) {
+    ids.push_back(ecs.get_id());
+  }
+  // created in any order, and kept in that order
+  for (int i = 5; i >= 0; --i) {
+    ages.create(ids[i], 10*i);
+  }
+  sizes.create(ids[1], 1.0f);
+  sizes.create(ids[4], 1.0f);
+  ecs.update();
+  std::cout << ages << ' ' << ages.sorted << std::endl;
+
+  // the last element moves into the hole
+  ecs.destroy(ids[4]);
+  ecs.update();
+  std::cout << ages << ' ' << *ages[ids[0]] << ' ' << (ages[ids[4]] == nullptr)
+            << std::endl;
+
+  // applying to it alone doesn't sort it
+  ecs.apply(ages, age);
+  ecs.wait();
+  std::cout << ages << ' ' << ages.sorted << std::endl;
+
+  // but joining does
+  ecs.apply(ages, sizes, scale);
+  ecs.wait();
+  std::cout << ages << ' ' << sizes << ' ' << ages.sorted << std::endl;
+
+  // and it stays sorted as long as nothing is created out of order
+  // (a new id is, but a reused one isn't)
+  ages.create(ecs.get_ids(1).first, 70);
+  ecs.update();
+  std::cout << ages.sorted << ' ';
+  ages.create(ecs.get_id(), 40);
+  ecs.update();
+  std::cout << ages.sorted << std::endl;
+
+  ages.set_lazy(false);
+  std::cout << ages << ' ' << ages.positions.size() << std::endl;
+  // [(6 50)(5 40)(4 30)(3 20)(2 10)(1 0)] 0
+  // [(6 50)(1 0)(4 30)(3 20)(2 10)] 0 1
+  // [(6 51)(1 1)(4 31)(3 21)(2 11)] 0
+  // [(1 1)(2 11)(3 21)(4 31)(6 51)] [(2 11)] 1
+  // 1 0
+  // [(1 1)(2 11)(3 21)(4 31)(5 40)(6 51)(7 70)] 0
+}
@@ -0,0 +1,51 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// the memory used by each component can be inspected
+// and with a shrink policy, update gives back memory after a spike
+
+void age(int &x) { ++x; }
+
+int main() {
+  ecs::Manager ecs(2);
+  ecs::Component<int> health;
+  ecs::Component<double> temporary;
+  ecs.enlist(&health, "health");
+  ecs.enlist(&temporary, "temporary");
+  ecs.shrink_policy.enabled = true;
+
+  for (int i = 0; i < 10; ++i) {
+    health.create(ecs.get_id(), i);
+  }
+  // a spike of temporary entities
+  auto ids = ecs.get_ids(100000);
+  for (auto id = ids.first; id < ids.last; ++id) {
+    temporary.create(id, 1.0);
+  }
+  ecs.update();
+  ecs.apply(health, age);
+  ecs.wait();
+
+  for (auto &[name, stats]: ecs.memory()) {
+    std::cout << name << ' ' << stats.size << ' '
+              << (stats.capacity >= stats.size) << ' '
+              << stats.create_high_water << ' '
+              << stats.destroy_high_water << std::endl;
+  }
+  auto before = ecs.memory()[1].second.bytes;
+
+  for (auto id = ids.first; id < ids.last; ++id) {
+    ecs.destroy(id);
+  }
+  ecs.update();
+
+  auto after = ecs.memory()[1].second;
+  std::cout << after.size << ' ' << after.capacity << ' '
+            << (after.bytes < before/100) << ' '
+            << after.destroy_high_water << std::endl;
+  // health 10 1 10 0
+  // temporary 100000 1 100000 0
+  // pool 0 1 1 0
+  // 0 0 1 100000
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// optional components arrive as a pointer, that is nullptr if missing
+
+void inc(int &a) { ++a; }
+
+void add(int &a, int &b) { a += b; }
+
+void add_maybe(int &a, int *b) {
+  if (b) {
+    a += *b;
+  } else {
+    a -= 100;
+  }
+}
+
+void add_maybe2(int &a, int *b, int *c) {
+  a += (b ? *b : 0) + (c ? *c : 0);
+}
+
+void add3(int &a, int &b, int &c) { a += b + c; }
+
+void add_and_maybe(int &a, int &b, int *c) {
+  a += b + (c ? *c : 1000);
+}
+
+int main() {
+  ecs::Manager ecs;
+
+  ecs::Component<int> a;
+  ecs::Component<int> b;
+  ecs::Component<int> c;
+  ecs::Component<int> d;
+  ecs.enlist(&a, "a");
+  ecs.enlist(&b, "b");
+  ecs.enlist(&c, "c");
+  ecs.enlist(&d, "d");
+
+  for (int i = 0; i < 12; ++i) {
+    auto id = ecs.get_id();
+    a.create(id, 0);
+    if (i % 2 == 0) b.create(id, 1);
+    if (i % 3 == 0) c.create(id, 10);
+    if (i % 4 == 0) d.create(id, 0);
+  }
+  ecs.update();
+
+  ecs.apply(a, &inc, b, c); // has a, but neither b nor c
+  ecs.wait();
+  std::cout << a << std::endl;
+  // [(1 0)(2 1)(3 0)(4 0)(5 0)(6 1)(7 0)(8 1)(9 0)(10 0)(11 0)(12 1)]
+
+  ecs.apply(a, b, &add, d); // has a and b, but not d
+  ecs.apply(a, ecs::optional(c), &add_maybe);
+  ecs.wait();
+  std::cout << a << std::endl;
+  // [(1 10)(2 -99)(3 -99)(4 10)(5 -100)(6 -99)(7 11)(8 -99)(9 -100)(10 10)(11 -99)(12 -99)]
+
+  ecs.apply(a, ecs::optional(b), ecs::optional(c), &add_maybe2, d);
+  ecs.apply(a, b, ecs::optional(c), &add_and_maybe);
+  ecs.wait();
+  std::cout << a << std::endl;
+  // [(1 21)(2 -99)(3 903)(4 20)(5 901)(6 -99)(7 33)(8 -99)(9 901)(10 20)(11 903)(12 -99)]
+
+  // excluding one component is the same as excluding several
+  // (also for the entities past the last excluded one)
+  ecs::Component<int> e, f, empty;
+  ecs.enlist(&e, "e");
+  ecs.enlist(&f, "f");
+  ecs.enlist(&empty, "empty");
+  for (uint32_t id = 1; id <= 12; ++id) {
+    e.create(id, 0);
+    f.create(id, 0);
+  }
+  ecs.update();
+  ecs.apply(e, &inc, d);
+  ecs.apply(f, &inc, d, empty);
+  ecs.apply(f, &inc, empty);
+  ecs.wait();
+  std::cout << e << std::endl;
+  std::cout << f << std::endl;
+  // [(1 0)(2 1)(3 1)(4 1)(5 0)(6 1)(7 1)(8 1)(9 0)(10 1)(11 1)(12 1)]
+  // [(1 1)(2 2)(3 2)(4 2)(5 1)(6 2)(7 2)(8 2)(9 1)(10 2)(11 2)(12 2)]
+
+  ecs.apply(e, b, c, &add3, d); // has e, b and c, but not d
+  ecs.wait();
+  std::cout << e << std::endl;
+  // [(1 0)(2 1)(3 1)(4 1)(5 0)(6 1)(7 12)(8 1)(9 0)(10 1)(11 1)(12 1)]
+}
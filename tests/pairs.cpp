@@ -0,0 +1,71 @@
+#include <iostream>
+#include <random>
+
+#include "ecsoplatm.h"
+
+// apply_pairs runs a function on all pairs of entities that are close
+
+struct Particle {
+  float x, y;
+  int neighbours;
+  float operator[](int i) const { return i ? y : x; }
+};
+
+void touch(Particle &a, Particle &b) {
+  ++a.neighbours;
+  ++b.neighbours;
+}
+
+int main() {
+  ecs::Manager ecs(4);
+
+  ecs::Component<Particle> particles;
+  ecs.enlist(&particles, "particles");
+
+  std::mt19937 rng(1337);
+  std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+  for (int i = 0; i < 5000; ++i) {
+    particles.create(ecs.get_id(), {coord(rng), coord(rng), 0});
+  }
+  ecs.update();
+
+  const float radius = 2.0f;
+  ecs.apply_pairs(particles, radius, &touch);
+  ecs.wait();
+
+  // compare with checking every pair
+  int wrong = 0;
+  long total = 0;
+  for (auto &[id, p]: particles.data) {
+    int neighbours = 0;
+    for (auto &[other_id, q]: particles.data) {
+      float dx = p.x - q.x;
+      float dy = p.y - q.y;
+      if ((id != other_id) && (dx*dx + dy*dy <= radius*radius)) {
+        ++neighbours;
+      }
+    }
+    wrong += neighbours != p.neighbours;
+    total += p.neighbours;
+  }
+  std::cout << total/2 << " pairs, " << wrong << " wrong" << std::endl;
+
+  // far away coordinates share the cells at the edge of the grid
+  // and a radius that isn't positive pairs nothing
+  ecs::Component<Particle> far;
+  ecs.enlist(&far, "far");
+  far.create(ecs.get_id(), {1e30f, 0.0f, 0});
+  far.create(ecs.get_id(), {1e30f, 1.0f, 0});
+  far.create(ecs.get_id(), {-1e30f, 1e30f, 0});
+  ecs.update();
+  ecs.apply_pairs(far, radius, &touch);
+  ecs.apply_pairs(far, 0.0f, &touch);
+  ecs.apply_pairs(far, -radius, &touch);
+  ecs.wait();
+  for (auto &[id, p]: far.data) {
+    std::cout << p.neighbours << ' ';
+  }
+  std::cout << std::endl;
+  // 15731 pairs, 0 wrong
+  // 1 1 0
+}
@@ -0,0 +1,66 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+using namespace std::chrono_literals;
+
+#include "ecsoplatm.h"
+
+// update only waits for the tasks that use the components it changes
+// so frames can overlap with slow systems on unrelated components
+// (up to frames_ahead frames, after which update waits for the oldest one)
+
+std::atomic<int> thinking {0};
+
+void think(int &brain) {
+  std::this_thread::sleep_for(1ms);
+  ++brain;
+  if (brain == 1) {
+    ++thinking;
+  }
+}
+
+void fall(float &height) {
+  height -= 1.0f;
+}
+
+int main() {
+  ecs::Manager ecs(4);
+
+  ecs::Component<int> brains;
+  ecs::Component<float> particles;
+  ecs.enlist(&brains, "brains");
+  ecs.enlist(&particles, "particles");
+
+  for (int i = 0; i < 256; ++i) {
+    brains.create(ecs.get_id(), 0);
+  }
+  ecs.update();
+
+  ecs.frames_ahead = 16; // let the frames below run ahead of think
+  ecs.apply(brains, &think); // takes a while, but is only one task
+
+  for (int frame = 0; frame < 10; ++frame) {
+    particles.create(ecs.get_id(), 10.0f);
+    ecs.apply(particles, &fall);
+    ecs.update(); // doesn't wait for think
+  }
+
+  std::cout << (thinking < 256 ? "overlapped" : "serialized") << std::endl;
+  ecs.wait();
+  std::cout << particles << std::endl;
+
+  // finished tasks are forgotten, so frames that never wait don't pile up
+  ecs.frames_ahead = 2;
+  size_t most = 0;
+  for (int frame = 0; frame < 1000; ++frame) {
+    ecs.apply(particles, &fall);
+    ecs.update();
+    most = std::max(most, ecs.pool.memory().size);
+  }
+  std::cout << (most <= 3) << std::endl;
+  ecs.wait();
+  // overlapped
+  // [(257 1)(258 2)(259 3)(260 4)(261 5)(262 6)(263 7)(264 8)(265 9)(266 10)]
+  // 1
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a query remembers which entities have all of its components
+// and only has to find them again if one of the components is updated
+
+void move(float &position, float &velocity) {
+  position += velocity;
+}
+
+void drag(float &velocity, float &mass, int &) {
+  velocity *= 1.0f - 0.1f/mass;
+}
+
+int main() {
+  ecs::Manager ecs;
+
+  ecs::Component<float> position;
+  ecs::Component<float> velocity;
+  ecs::Component<float> mass;
+  ecs::Component<int> tag;
+  ecs.enlist(&position, "position");
+  ecs.enlist(&velocity, "velocity");
+  ecs.enlist(&mass, "mass");
+  ecs.enlist(&tag, "tag");
+
+  for (int i = 0; i < 8; ++i) {
+    auto id = ecs.get_id();
+    position.create(id, 0.0f);
+    if (i % 2 == 0) velocity.create(id, 1.0f);
+    if (i % 4 == 0) mass.create(id, 1.0f);
+    if (i % 4 == 2) mass.create(id, 2.0f);
+    if (i < 6) tag.create(id, 0);
+  }
+  ecs.update();
+
+  ecs::Query<float, float> moving(position, velocity);
+  ecs::Query<float, float, int> dragged(velocity, mass, tag);
+
+  for (int frame = 0; frame < 3; ++frame) {
+    ecs.apply(moving, &move);
+    ecs.apply(dragged, &drag);
+  }
+  ecs.wait();
+
+  std::cout << moving.matches.size() << ' '
+            << dragged.matches.size() << std::endl;
+  std::cout << position << std::endl;
+  std::cout << velocity << std::endl;
+  // 4 3
+  // [(1 2.71)(2 0)(3 2.8525)(4 0)(5 2.71)(6 0)(7 3)(8 0)]
+  // [(1 0.729)(3 0.857375)(5 0.729)(7 1)]
+
+  // updating velocity invalidates both queries
+  velocity.create(2, 1.0f);
+  ecs.update();
+  ecs.apply(moving, &move);
+  ecs.wait();
+  std::cout << moving.matches.size() << std::endl;
+  std::cout << position << std::endl;
+  // 5
+  // [(1 3.439)(2 1)(3 3.70987)(4 0)(5 3.439)(6 0)(7 4)(8 0)]
+}
@@ -0,0 +1,49 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// reductions get the partial result of their task as the first argument
+
+void sum(long &total, int &a) {
+  total += a;
+}
+
+void dot(long &total, int &a, int &b) {
+  total += a*b;
+}
+
+void max(int &best, int &a) {
+  best = std::max(best, a);
+}
+
+void combine_max(int &best, int &partial) {
+  best = std::max(best, partial);
+}
+
+int main() {
+  ecs::Manager ecs;
+
+  ecs::Component<int> a;
+  ecs::Component<int> b;
+  ecs.enlist(&a, "a");
+  ecs.enlist(&b, "b");
+
+  for (int i = 0; i < 10000; ++i) {
+    auto id = ecs.get_id();
+    a.create(id, i);
+    if (i % 3 == 0) {
+      b.create(id, 2);
+    }
+  }
+  ecs.update();
+
+  auto total = ecs.apply_accumulate(a, 0l, &sum);
+  auto best = ecs.apply_reduce(a, 0, &max, &combine_max);
+  auto product = ecs.apply_accumulate(a, b, 0l, &dot);
+
+  // the futures can be waited on individually, no need for ecs.wait()
+  std::cout << total.get() << std::endl; // 49995000
+  std::cout << best.get() << std::endl; // 9999
+  std::cout << product.get() << std::endl; // 33336666
+  ecs.wait();
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// shared data can be passed to apply as a resource
+// then only the systems that write it are ordered with the others that use it
+
+struct Histogram {
+  int bins[4];
+};
+
+void count(int &x, Histogram &h) { ++h.bins[x % 4]; }
+void count_both(int &x, float &, Histogram &h) { h.bins[x % 4] += 10; }
+void scale(float &y, const float &factor) { y *= factor; }
+void copy_first(int &x, const Histogram &h) { x = h.bins[0]; }
+
+int main() {
+  ecs::Manager ecs(4);
+  ecs::Component<int> ints;
+  ecs::Component<float> floats;
+  ecs::Resource<Histogram> histogram(Histogram {0, 0, 0, 0});
+  ecs::Resource<float> factor(2.0f);
+  ecs.enlist(&ints, "ints");
+  ecs.enlist(&floats, "floats");
+  ecs.enlist(&histogram, "histogram");
+  ecs.enlist(&factor, "factor");
+
+  for (int i = 0; i < 2000; ++i) {
+    auto id = ecs.get_id();
+    ints.create(id, i);
+    if (i % 2 == 0) floats.create(id, 1.0f);
+  }
+  ecs.update();
+
+  // the two writes are ordered, but the scale doesn't wait for them
+  ecs.apply(ints, count, ecs::write(histogram));
+  ecs.apply(ints, floats, count_both, ecs::write(histogram));
+  ecs.apply(floats, scale, ecs::read(factor));
+  ecs.update(histogram); // wait for it, to read it here
+  for (auto bin: histogram.value.bins) {
+    std::cout << bin << ' ';
+  }
+  std::cout << std::endl;
+
+  // the read waits for the write before it
+  ecs.apply(ints, copy_first, ecs::read(histogram));
+  ecs.wait();
+  std::cout << *ints[7] << ' ' << *floats[1] << std::endl;
+
+  // update doesn't wait for the readers, which are forgotten once done
+  size_t most = 0;
+  for (int frame = 0; frame < 200; ++frame) {
+    ecs.apply(ints, copy_first, ecs::read(histogram));
+    ecs.update();
+    most = std::max(most, histogram.readers.size());
+  }
+  ecs.wait();
+  std::cout << (most < 100) << std::endl;
+  // 5500 500 5500 500
+  // 5500 2
+  // 1
+}
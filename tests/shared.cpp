@@ -0,0 +1,62 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a shared component can be read by other processes through shared memory
+// (here the reader is in the same process, but it maps the region separately)
+
+struct Position {
+  float x, y;
+};
+
+void move(Position &p) { p.x += 1.0f; p.y -= 1.0f; }
+
+int main() {
+  std::string name = "/ecsoplatm_shared_" + std::to_string(getpid());
+  ecs::Manager ecs;
+  ecs::Shared<ecs::Component<Position>> positions(name);
+  ecs.enlist(&positions, "positions");
+  std::cout << positions.is_shared() << std::endl;
+
+  for (int i = 0; i < 3; ++i) {
+    positions.create(ecs.get_id(), {float(i), float(i)});
+  }
+  ecs.update();
+
+  ecs::SharedReader<Position> reader(name);
+  std::cout << reader.is_open() << ' ' << reader.epoch() << std::endl;
+
+  // values written by systems are published in the next update
+  ecs.apply(positions, move);
+  ecs.update();
+  std::vector<std::pair<uint32_t, Position>> copy;
+  reader.read(copy);
+  for (auto &[id, p]: copy) {
+    std::cout << id << ':' << p.x << ',' << p.y << ' ';
+  }
+  std::cout << reader.epoch() << std::endl;
+
+  // the region grows as needed, and the reader remaps it
+  for (int i = 0; i < 5000; ++i) {
+    positions.create(ecs.get_id(), {0.0f, 0.0f});
+  }
+  ecs.destroy(2);
+  ecs.update();
+  size_t count = 0;
+  uint32_t first = 0;
+  reader.view([&](std::span<const std::pair<uint32_t, Position>> elements) {
+    count = elements.size();
+    first = elements[1].first;
+  });
+  std::cout << count << ' ' << first << ' ' << reader.epoch() << std::endl;
+
+  // a reader for the wrong type (or a missing region) is not open
+  ecs::SharedReader<double> wrong(name);
+  ecs::SharedReader<Position> missing(name + "_missing");
+  std::cout << wrong.is_open() << ' ' << missing.is_open() << std::endl;
+  // 1
+  // 1 2
+  // 1:1,-1 2:2,0 3:3,1 3
+  // 5002 3 4
+  // 0 0
+}
@@ -0,0 +1,101 @@
+#include <filesystem>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// the world can be saved into a binary snapshot, and loaded again
+// components are matched by the name they were enlisted with
+
+struct Position {
+  // (no default constructor, which is fine as long as it's trivially copyable)
+  Position(float x_, float y_) : x(x_), y(y_) {}
+  float x, y;
+};
+
+std::ostream &operator<<(std::ostream &out, const Position &p) {
+  return out << p.x << ',' << p.y;
+}
+
+int main() {
+  auto dir = std::filesystem::temp_directory_path();
+  auto snapshot = (dir/"ecsoplatm_snapshot.bin").string();
+  auto broken = (dir/"ecsoplatm_broken.bin").string();
+  {
+    ecs::Manager ecs;
+    ecs::Component<Position> position;
+    ecs::Component<int> health;
+    ecs.enlist(&position, "position");
+    ecs.enlist(&health, "health");
+
+    for (int i = 0; i < 6; ++i) {
+      auto id = ecs.get_id();
+      position.create(id, {static_cast<float>(i), -1.0f});
+      if (i % 2 == 0) health.create(id, 100 - i);
+    }
+    ecs.update();
+    ecs.destroy(3);
+    ecs.update();
+
+    std::cout << ecs.save(snapshot) << std::endl;
+  }
+
+  ecs::Manager ecs;
+  ecs::Component<int> health; // the order doesn't matter
+  ecs::Component<Position> position;
+  ecs.enlist(&health, "health");
+  ecs.enlist(&position, "position");
+
+  std::cout << ecs.load(snapshot) << std::endl;
+  std::cout << position << std::endl;
+  std::cout << health << std::endl;
+  std::cout << ecs.get_id() << std::endl; // reuses the destroyed id
+  std::cout << ecs.get_id() << std::endl;
+  ecs.debug_print_entity_components(5);
+
+  // a broken snapshot is rejected before anything is replaced
+  std::filesystem::copy_file(snapshot, broken,
+                             std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::resize_file(broken, std::filesystem::file_size(snapshot) - 4);
+  health.destroy(5);
+  ecs.update();
+  std::cout << ecs.load(broken) << ' ' << health << ' '
+            << ecs.get_id() << std::endl;
+
+  // components are told apart by name, so they need distinct names
+  std::filesystem::remove(broken);
+  {
+    ecs::Manager ecs;
+    ecs::Component<int> x, y;
+    ecs.enlist(&x);
+    ecs.enlist(&y);
+    x.create(ecs.get_id(), 1);
+    y.create(ecs.get_id(), 2);
+    ecs.update();
+    std::cout << ecs.save(broken) << ' ' << std::filesystem::exists(broken);
+    ecs::Manager named;
+    ecs::Component<int> a, b;
+    named.enlist(&a, "same");
+    named.enlist(&b, "same");
+    std::cout << ' ' << named.save(broken) << std::endl;
+  }
+  {
+    ecs::Manager ecs; // two loaders, but only one health in the file
+    ecs::Component<int> health, other;
+    ecs.enlist(&health, "health");
+    ecs.enlist(&other, "health");
+    std::cout << ecs.load(snapshot) << ' ' << health << std::endl;
+  }
+
+  std::filesystem::remove(snapshot);
+  std::filesystem::remove(broken);
+  // 1
+  // 1
+  // [(1 0,-1)(2 1,-1)(4 3,-1)(5 4,-1)(6 5,-1)]
+  // [(1 100)(5 96)]
+  // 3
+  // 7
+  // 5 : health position
+  // 0 [(1 100)] 8
+  // 0 0 0
+  // 0 []
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// every apply is counted under the function that was applied
+// (and named after the system that applied it, if any)
+// or also under its call site, if tagged with at()
+
+void heal(int &health, float &) { health += 1; }
+void decay(float &armor) { armor *= 0.5f; }
+
+int main() {
+  ecs::Manager ecs(4);
+  ecs::Component<int> health;
+  ecs::Component<float> armor;
+  ecs.enlist(&health, "health");
+  ecs.enlist(&armor, "armor");
+
+  for (int i = 0; i < 1000; ++i) {
+    auto id = ecs.get_id();
+    health.create(id, 100);
+    if (i % 4 == 0) armor.create(id, 1.0f);
+  }
+  ecs.update();
+
+  ecs.add_system("decay", {}, {&armor}, [&](ecs::Manager &m) {
+    m.apply(armor, &decay);
+  });
+
+  for (int frame = 0; frame < 3; ++frame) {
+    ecs.apply(health, armor, heal);
+    ecs.run_systems();
+    ecs.update();
+  }
+  ecs.wait();
+
+  auto s = ecs.stats(heal);
+  std::cout << s.calls << ' ' << s.blocks << ' ' << s.visited << ' '
+            << s.matched << ' ' << (s.execute > 0.0) << std::endl;
+  for (auto &s: ecs.stats()) {
+    if (s.name == "decay") {
+      std::cout << s.name << ' ' << s.calls << ' ' << s.blocks << ' '
+                << s.visited << ' ' << s.matched << std::endl;
+    }
+  }
+  // the same function from two places
+  ecs.at().apply(armor, &decay);
+  ecs.at().apply(armor, &decay);
+  ecs.wait();
+  int tagged = 0;
+  for (auto &s: ecs.stats()) {
+    tagged += !s.site.empty() && (s.calls == 1) && (s.visited == 250);
+  }
+  std::cout << tagged << ' ' << ecs.stats(decay).calls << std::endl;
+
+  auto utilization = ecs.utilization();
+  std::cout << ((utilization > 0.0) && (utilization <= 1.0)) << std::endl;
+  ecs.reset_stats();
+  std::cout << ecs.stats(heal).calls << std::endl;
+  // 3 6 3705 750 1
+  // decay 3 3 750 750
+  // 2 5
+  // 1
+  // 0
+}
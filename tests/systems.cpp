@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// systems can be registered with the components they read and write
+// and are then run in stages of systems that don't conflict
+
+void accelerate(float &velocity, float &force) { velocity += force; }
+void move(float &position, float &velocity) { position += velocity; }
+void age(int &age) { ++age; }
+void gravity(float &force) { force = -1.0f; }
+
+// two systems that only read the same component, each of which waits
+// (for a while) for the other to start, which works if they overlap
+std::atomic<int> started {0};
+std::atomic<int> met {0};
+void meet(float &, int &seen) {
+  ++started;
+  auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while ((started < 2) && (std::chrono::steady_clock::now() < give_up)) {}
+  seen = 1;
+  met += (started >= 2);
+}
+
+int main() {
+  ecs::Manager ecs;
+
+  ecs::Component<float> position;
+  ecs::Component<float> velocity;
+  ecs::Component<float> force;
+  ecs::Component<int> ages;
+  ecs.enlist(&position, "position");
+  ecs.enlist(&velocity, "velocity");
+  ecs.enlist(&force, "force");
+  ecs.enlist(&ages, "age");
+
+  for (int i = 0; i < 4; ++i) {
+    auto id = ecs.get_id();
+    position.create(id, 0.0f);
+    velocity.create(id, 1.0f);
+    force.create(id, 0.0f);
+    ages.create(id, 0);
+  }
+  ecs.update();
+
+  ecs.add_system("gravity", {}, {&force}, [&](ecs::Manager &m) {
+    m.apply(force, &gravity);
+  });
+  ecs.add_system("accelerate", {&force}, {&velocity}, [&](ecs::Manager &m) {
+    m.apply(velocity, force, &accelerate);
+  });
+  ecs.add_system("move", {&velocity}, {&position}, [&](ecs::Manager &m) {
+    m.apply(position, velocity, &move);
+  });
+  ecs.add_system("age", {}, {&ages}, [&](ecs::Manager &m) {
+    m.apply(ages, &age);
+  });
+
+  ecs.debug_print_schedule();
+  // 0 : gravity age
+  // 1 : accelerate
+  // 2 : move
+
+  for (int frame = 0; frame < 3; ++frame) {
+    ecs.run_systems();
+    ecs.update();
+  }
+  ecs.wait();
+
+  std::cout << position << std::endl;
+  std::cout << ages << std::endl;
+
+  // the components a system only reads are tracked as read while it runs
+  // and using a component that wasn't declared is reported
+  ecs::Manager readers(2);
+  ecs::Component<float> shared;
+  ecs::Component<int> first;
+  ecs::Component<int> second;
+  readers.enlist(&shared, "shared");
+  readers.enlist(&first, "first");
+  readers.enlist(&second, "second");
+  auto id = readers.get_id();
+  shared.create(id, 0.0f);
+  first.create(id, 0);
+  second.create(id, 0);
+  readers.update();
+  readers.add_system("first", {&shared}, {&first}, [&](ecs::Manager &m) {
+    m.apply(shared, first, &meet);
+  });
+  readers.add_system("second", {&shared}, {&second}, [&](ecs::Manager &m) {
+    m.apply(shared, second, &meet);
+  });
+  std::cout << readers.run_systems() << ' ';
+  readers.wait();
+  std::cout << met << std::endl;
+  readers.add_system("sneaky", {}, {&first}, [&](ecs::Manager &m) {
+    m.apply(shared, first, &meet);
+  });
+  std::cout << readers.run_systems() << std::endl;
+  readers.wait();
+  // [(1 -3)(2 -3)(3 -3)(4 -3)]
+  // [(1 3)(2 3)(3 3)(4 3)]
+  // 1 2
+  // 0
+}
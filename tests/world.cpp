@@ -0,0 +1,96 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// a world knows its components at compile time, and so do its systems
+
+struct Position { float x; };
+struct Velocity { float x; };
+struct Mass { float m; };
+
+using Positions = ecs::Component<Position>;
+using Velocities = ecs::Component<Velocity>;
+using Masses = ecs::Component<Mass>;
+
+using Move = ecs::Access<ecs::Reads<Velocities>, ecs::Writes<Positions>>;
+using Gravity = ecs::Access<ecs::Reads<Masses>, ecs::Writes<Velocities>>;
+using Weigh = ecs::Access<ecs::Reads<Masses>, ecs::Writes<>>;
+
+// checked without running anything
+static_assert(ecs::conflicts<Move, Gravity>);
+static_assert(!ecs::conflicts<Gravity, Weigh>);
+static_assert(!ecs::conflicts<Move, Weigh>);
+static_assert(ecs::stages<Gravity, Weigh, Move>() == std::array<int, 3> {0, 0, 1});
+
+void move(Velocity &v, Position &p) { p.x += v.x; }
+void gravity(Mass &m, Velocity &v) { v.x -= m.m; }
+
+int main() {
+  ecs::Component<int> tags; // not part of the world, but enlisted in it
+  ecs::World<Positions, Velocities, Masses> world({"position", "velocity", "mass"});
+  world.enlist(&tags, "tag");
+
+  for (int i = 0; i < 3; ++i) {
+    auto id = world.get_id();
+    world.get<Positions>().create(id, {float(i)});
+    world.get<Velocities>().create(id, {1.0f});
+    if (i != 1) {
+      world.get<Masses>().create(id, {0.5f});
+    }
+    if (i < 2) {
+      tags.create(id, i);
+    }
+  }
+  world.update();
+
+  world.add_system<Gravity>("gravity", [](auto &w) {
+    w.apply(w.template get<Masses>(), w.template get<Velocities>(), gravity);
+  });
+  world.add_system<Move>("move", [](auto &w) {
+    w.apply(w.template get<Velocities>(), w.template get<Positions>(), move);
+  });
+  std::cout << world.schedule().size() << std::endl;
+
+  for (int frame = 0; frame < 2; ++frame) {
+    world.run_systems();
+    world.update();
+  }
+  for (auto &[id, p]: world.get<Positions>().data) {
+    std::cout << id << ':' << p.x << ' ';
+  }
+  std::cout << std::endl;
+
+  world.debug_print_entity_components(1);
+  world.debug_print_entity_components(2);
+  world.destroy(1);
+  world.update();
+  world.debug_print_entity_components(1);
+  std::cout << world.get<0>().data.size() << ' ' << world.get<2>().data.size()
+            << ' ' << tags.data.size() << std::endl;
+
+  // a single component can be updated too (typed if it's in the world)
+  world.get<Positions>().destroy(2);
+  tags.destroy(2);
+  world.update(world.get<Positions>());
+  world.update(tags);
+  std::cout << world.get<0>().data.size() << ' ' << tags.data.size()
+            << std::endl;
+
+  // without names, the components are named by their types
+  // (and the systems of a Manager can be added too)
+  ecs::World<Positions, Masses> unnamed;
+  unnamed.add_system("count", {&unnamed.get<Masses>()}, {},
+                     [](ecs::Manager &) {});
+  for (auto &name: unnamed.component_names) {
+    std::cout << name << ' ';
+  }
+  std::cout << unnamed.systems.size() << std::endl;
+  // 2
+  // 1:0.5 2:3 3:2.5
+  // 1 : position velocity mass tag 
+  // 2 : position velocity tag 
+  // 1 : 
+  // 2 1 1
+  // 1 0
+  // Component<Position> Component<Mass> 1
+}
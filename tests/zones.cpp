@@ -0,0 +1,63 @@
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// components keep the first and last id of every block (zone)
+// so sparse joins skip the parts of the components that can't match
+// and don't even schedule the tasks that would find nothing
+
+void add(int &a, int &b) { b += a; }
+void add3(int &a, int &b, int &c) { c += a + b; }
+void sum(int &total, int &a, int &b) { total += a*b; }
+
+int main() {
+  ecs::Manager ecs;
+  ecs::Component<int> dense;
+  ecs::Component<int> sparse;
+  ecs::Component<int> few;
+  ecs.enlist(&dense, "dense");
+  ecs.enlist(&sparse, "sparse");
+  ecs.enlist(&few, "few");
+
+  auto ids = ecs.get_ids(20000);
+  for (uint32_t id = ids.first; id < ids.last; ++id) {
+    dense.create(id, 1);
+    if ((id > 15000) && (id % 100 == 0)) {
+      sparse.create(id, 0);
+    }
+    if (id % 1000 == 0) {
+      few.create(id, 0);
+    }
+  }
+  ecs.update();
+  std::cout << dense.zones.zones.size() << ' '
+            << dense.zones.zones[1].first << ' '
+            << dense.zones.zones[1].second << std::endl;
+
+  // only the blocks near the end of dense can match
+  ecs.apply(dense, sparse, add);
+  ecs.wait();
+  auto stats = ecs.stats(add);
+  std::cout << stats.matched << ' ' << stats.blocks << ' '
+            << *sparse[15100] << ' ' << *sparse[19900] << std::endl;
+
+  ecs.apply(dense, sparse, few, add3);
+  ecs.wait();
+  std::cout << ecs.stats(add3).matched << ' ' << *few[16000] << ' '
+            << *few[5000] << std::endl;
+
+  auto total = ecs.apply_accumulate(dense, few, 0, sum);
+  std::cout << total.get() << std::endl;
+
+  // the zones follow the data through update
+  ecs.destroy(1);
+  ecs.destroy(2);
+  ecs.update();
+  std::cout << dense.zones.zones[0].first << ' '
+            << dense.zones.zones[0].second << std::endl;
+  // 79 257 512
+  // 50 15 1 1
+  // 5 2 0
+  // 10
+  // 3 258
+}
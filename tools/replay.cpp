@@ -0,0 +1,21 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "ecsoplatm.h"
+
+// rebuild the snapshot of any frame from a base snapshot and a journal
+//   replay base.bin journal.bin frame out.bin
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    std::cerr << "usage: " << argv[0]
+              << " <base snapshot> <journal> <frame> <output snapshot>"
+              << std::endl;
+    return 1;
+  }
+  uint64_t frame = std::strtoull(argv[3], nullptr, 10);
+  if (!ecs::rebuild_snapshot(argv[1], argv[2], frame, argv[4])) {
+    std::cerr << "failed to rebuild frame " << frame << std::endl;
+    return 1;
+  }
+}